@@ -0,0 +1,202 @@
+/// Discovery benchmark
+/// Registers a number of stand-in services with the local mDNS responder and measures
+/// time-to-first-result, time-to-all-results and CPU time per discovery for every engine.
+///
+/// usage: discovery_bench [services] [rounds]
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+#include "browse_mdns.hpp"
+#include "common/snap_exception.hpp"
+#if defined(HAS_AVAHI) && !defined(HAS_BONJOUR)
+#include <avahi-client/publish.h>
+#endif
+
+using namespace std;
+
+static constexpr auto SERVICE_TYPE = "_sprbench._tcp.";
+static constexpr uint16_t SERVICE_PORT = 1705;
+static constexpr int TIMEOUT = 5000;
+
+
+/// Local stand-in for the controllers: publishes count services through the local mDNS daemon
+class Responder
+{
+public:
+    explicit Responder(size_t count);
+    ~Responder();
+
+private:
+#if defined(HAS_BONJOUR)
+    vector<DNSServiceRef> refs_;
+#elif defined(HAS_AVAHI)
+    static void client_callback(AvahiClient* c, AvahiClientState state, void* userdata);
+    AvahiThreadedPoll* poll_;
+    AvahiClient* client_;
+    AvahiEntryGroup* group_;
+#endif
+};
+
+
+#if defined(HAS_BONJOUR)
+Responder::Responder(size_t count)
+{
+    for (size_t n = 0; n < count; ++n)
+    {
+        DNSServiceRef ref = nullptr;
+        string name = "bench-" + to_string(n);
+        auto err = DNSServiceRegister(&ref, 0, 0, name.c_str(), SERVICE_TYPE, "local.", nullptr, htons(SERVICE_PORT), 0, nullptr,
+                                      [](DNSServiceRef, DNSServiceFlags, DNSServiceErrorType, const char*, const char*, const char*, void*) {}, nullptr);
+        if (err != kDNSServiceErr_NoError)
+            throw SnapException("Failed to register " + name, err);
+        // wait for the registration to be confirmed
+        DNSServiceProcessResult(ref);
+        refs_.push_back(ref);
+    }
+}
+
+
+Responder::~Responder()
+{
+    for (auto ref : refs_)
+        DNSServiceRefDeallocate(ref);
+}
+#elif defined(HAS_AVAHI)
+void Responder::client_callback(AvahiClient* /*c*/, AvahiClientState /*state*/, void* /*userdata*/)
+{
+}
+
+
+Responder::Responder(size_t count) : poll_(avahi_threaded_poll_new()), client_(nullptr), group_(nullptr)
+{
+    int error;
+    if ((poll_ == nullptr) ||
+        ((client_ = avahi_client_new(avahi_threaded_poll_get(poll_), static_cast<AvahiClientFlags>(0), client_callback, this, &error)) == nullptr))
+        throw SnapException("Failed to create Avahi client");
+    if ((group_ = avahi_entry_group_new(client_, nullptr, nullptr)) == nullptr)
+        throw SnapException("Failed to create Avahi entry group");
+    for (size_t n = 0; n < count; ++n)
+    {
+        string name = "bench-" + to_string(n);
+        if (avahi_entry_group_add_service(group_, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, static_cast<AvahiPublishFlags>(0), name.c_str(), SERVICE_TYPE,
+                                          nullptr, nullptr, SERVICE_PORT, nullptr) < 0)
+            throw SnapException("Failed to register " + name);
+    }
+    avahi_entry_group_commit(group_);
+    avahi_threaded_poll_start(poll_);
+}
+
+
+Responder::~Responder()
+{
+    avahi_threaded_poll_stop(poll_);
+    if (group_ != nullptr)
+        avahi_entry_group_free(group_);
+    if (client_ != nullptr)
+        avahi_client_free(client_);
+    avahi_threaded_poll_free(poll_);
+}
+#endif
+
+
+/// @return consumed user + system CPU time of the process
+static chrono::microseconds cpuTime()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+
+struct Sample
+{
+    double wallMs;
+    double cpuMs;
+    size_t found;
+};
+
+
+/// Run f rounds times and collect wall and CPU time per run
+template <typename F>
+static vector<Sample> measure(size_t rounds, F f)
+{
+    vector<Sample> samples;
+    for (size_t n = 0; n < rounds; ++n)
+    {
+        auto cpu = cpuTime();
+        auto start = chrono::steady_clock::now();
+        size_t found = f();
+        auto wall = chrono::steady_clock::now() - start;
+        samples.push_back(Sample{chrono::duration<double, milli>(wall).count(), chrono::duration<double, milli>(cpuTime() - cpu).count(), found});
+    }
+    return samples;
+}
+
+
+static void report(const string& engine, const string& what, const vector<Sample>& samples)
+{
+    double minMs = samples.front().wallMs, maxMs = 0, sumMs = 0, cpuMs = 0;
+    size_t found = 0;
+    for (const auto& sample : samples)
+    {
+        minMs = std::min(minMs, sample.wallMs);
+        maxMs = std::max(maxMs, sample.wallMs);
+        sumMs += sample.wallMs;
+        cpuMs += sample.cpuMs;
+        found += sample.found;
+    }
+    printf("%-8s %-14s min %8.1f ms  avg %8.1f ms  max %8.1f ms  cpu %7.2f ms  found %5.1f\n", engine.c_str(), what.c_str(), minMs, sumMs / samples.size(),
+           maxMs, cpuMs / samples.size(), static_cast<double>(found) / samples.size());
+}
+
+
+int main(int argc, char** argv)
+{
+    size_t services = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 10;
+    size_t rounds = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 5;
+
+    try
+    {
+        Responder responder(services);
+        // give the responder time to probe and announce
+        this_thread::sleep_for(chrono::seconds(2));
+
+        vector<pair<string, mDNSEngine>> engines;
+#if defined(HAS_BONJOUR)
+        engines.emplace_back("bonjour", mDNSEngine::Bonjour);
+#endif
+#if defined(HAS_AVAHI)
+        engines.emplace_back("avahi", mDNSEngine::Avahi);
+#endif
+
+        printf("%zu services, %zu rounds\n", services, rounds);
+        for (const auto& engine : engines)
+        {
+            auto browser = BrowsemDNS::create(engine.second);
+            report(engine.first, "first result", measure(rounds, [&browser]() -> size_t {
+                       mDNSResult result;
+                       return browser->browse("", SERVICE_TYPE, "", result, TIMEOUT) ? 1 : 0;
+                   }));
+            report(engine.first, "all results", measure(rounds, [&browser]() -> size_t {
+                       vector<mDNSResult> results;
+                       browser->browse("", SERVICE_TYPE, "", results, TIMEOUT);
+                       return results.size();
+                   }));
+        }
+    }
+    catch (const std::exception& e)
+    {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -19,31 +19,54 @@
 #include "browse_avahi.hpp"
 #include "common/aixlog.hpp"
 #include "common/snap_exception.hpp"
+#include "common/str_compat.hpp"
+#include <algorithm>
+#include <boost/asio.hpp>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
+#include <net/if.h>
+#include <thread>
 
 
-static AvahiSimplePoll* simple_poll = nullptr;
-
 static constexpr auto LOG_TAG = "Avahi";
 
+/// Limit for browses that are called without a timeout
+static constexpr int DEFAULT_TIMEOUT = 3000;
+/// Time the other address family gets after the first address arrived (RFC 8305 "Resolution Delay")
+static constexpr auto RESOLUTION_DELAY = std::chrono::milliseconds(50);
+
 
-BrowseAvahi::BrowseAvahi() : client_(nullptr), sb_(nullptr)
+BrowseAvahi::BrowseAvahi() : simple_poll_(nullptr), client_(nullptr), sb_(nullptr), firstHit_(false), allForNow_(false), cancelled_(false)
 {
 }
 
 
 BrowseAvahi::~BrowseAvahi()
 {
+    // no helper thread may outlive the browser, nor the io_context its owner runs on
+    std::list<AsyncBrowse> browses;
+    {
+        std::lock_guard<std::mutex> lock(asyncMutex_);
+        browses.swap(asyncBrowses_);
+    }
+    for (auto& browse : browses)
+        browse.browser->cancelled_ = true;
+    for (auto& browse : browses)
+        browse.thread.join();
     cleanUp();
 }
 
 
 void BrowseAvahi::cleanUp()
 {
+    for (auto resolver : resolvers_)
+        avahi_service_resolver_free(resolver.first);
+    resolvers_.clear();
+    names_.clear();
+
     if (sb_ != nullptr)
         avahi_service_browser_free(sb_);
     sb_ = nullptr;
@@ -52,9 +75,9 @@ void BrowseAvahi::cleanUp()
         avahi_client_free(client_);
     client_ = nullptr;
 
-    if (simple_poll != nullptr)
-        avahi_simple_poll_free(simple_poll);
-    simple_poll = nullptr;
+    if (simple_poll_ != nullptr)
+        avahi_simple_poll_free(simple_poll_);
+    simple_poll_ = nullptr;
 }
 
 
@@ -82,13 +105,23 @@ void BrowseAvahi::resolve_callback(AvahiServiceResolver* r, AVAHI_GCC_UNUSED Ava
             LOG(INFO, LOG_TAG) << "Service '" << name << "' of type '" << type << "' in domain '" << domain << "':\n";
 
             avahi_address_snprint(a, sizeof(a), address);
-            browseAvahi->result_.host = host_name;
-            browseAvahi->result_.ip = a;
-            browseAvahi->result_.port = port;
+            mDNSResult result;
+            result.host = host_name;
+            result.ip = a;
+            result.port = port;
             // protocol seems to be unreliable (0 for IPv4 and for IPv6)
-            browseAvahi->result_.ip_version = (browseAvahi->result_.ip.find(':') == std::string::npos) ? (IPVersion::IPv4) : (IPVersion::IPv6);
-            browseAvahi->result_.valid = true;
-            browseAvahi->result_.iface_idx = interface;
+            result.ip_version = (result.ip.find(':') == std::string::npos) ? (IPVersion::IPv4) : (IPVersion::IPv6);
+            result.valid = true;
+            result.iface_idx = interface;
+            // the resolver doesn't report the record TTL
+            result.ttl = 0;
+            if (browseAvahi->results_.empty())
+                browseAvahi->firstResult_ = std::chrono::steady_clock::now();
+            auto started = browseAvahi->resolvers_.find(r);
+            result.rtt = (started == browseAvahi->resolvers_.end())
+                             ? 0
+                             : static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started->second).count());
+            browseAvahi->results_.push_back(result);
 
             t = avahi_string_list_to_string(txt);
             LOG(INFO, LOG_TAG) << "\t" << host_name << ":" << port << " (" << a << ")\n";
@@ -104,6 +137,7 @@ void BrowseAvahi::resolve_callback(AvahiServiceResolver* r, AVAHI_GCC_UNUSED Ava
         }
     }
 
+    browseAvahi->resolvers_.erase(r);
     avahi_service_resolver_free(r);
 }
 
@@ -122,22 +156,35 @@ void BrowseAvahi::browse_callback(AvahiServiceBrowser* b, AvahiIfIndex interface
     {
         case AVAHI_BROWSER_FAILURE:
             LOG(ERROR, LOG_TAG) << "(Browser) " << avahi_strerror(avahi_client_errno(avahi_service_browser_get_client(b))) << "\n";
-            avahi_simple_poll_quit(simple_poll);
+            avahi_simple_poll_quit(browseAvahi->simple_poll_);
             return;
 
         case AVAHI_BROWSER_NEW:
+        {
             LOG(INFO, LOG_TAG) << "(Browser) NEW: service '" << name << "' of type '" << type << "' in domain '" << domain << "'\n";
 
-            /* We ignore the returned resolver object. In the callback
-               function we free it. If the server is terminated before
-               the callback function is called the server will free
-               the resolver for us. */
+            // Skip unexpected services and services that are already being resolved on another interface
+            if (!browseAvahi->serviceName_.empty() && (browseAvahi->serviceName_ != name))
+                break;
+            if (!browseAvahi->names_.insert(name).second)
+                break;
 
-            if ((avahi_service_resolver_new(browseAvahi->client_, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC, static_cast<AvahiLookupFlags>(0),
-                                            resolve_callback, userdata)) == nullptr)
-                LOG(ERROR, LOG_TAG) << "Failed to resolve service '" << name << "': " << avahi_strerror(avahi_client_errno(browseAvahi->client_)) << "\n";
+            /* The resolvers are freed in the callback function, or in
+               cleanUp if the browse ends before they report.
+               One resolver per address family, so that both are resolved in parallel. */
+
+            for (AvahiProtocol aprotocol : {AVAHI_PROTO_INET6, AVAHI_PROTO_INET})
+            {
+                AvahiServiceResolver* resolver = avahi_service_resolver_new(browseAvahi->client_, interface, protocol, name, type, domain, aprotocol,
+                                                                            static_cast<AvahiLookupFlags>(0), resolve_callback, userdata);
+                if (resolver == nullptr)
+                    LOG(ERROR, LOG_TAG) << "Failed to resolve service '" << name << "': " << avahi_strerror(avahi_client_errno(browseAvahi->client_)) << "\n";
+                else
+                    browseAvahi->resolvers_[resolver] = std::chrono::steady_clock::now();
+            }
 
             break;
+        }
 
         case AVAHI_BROWSER_REMOVE:
             LOG(INFO, LOG_TAG) << "(Browser) REMOVE: service '" << name << "' of type '" << type << "' in domain '" << domain << "'\n";
@@ -146,6 +193,8 @@ void BrowseAvahi::browse_callback(AvahiServiceBrowser* b, AvahiIfIndex interface
         case AVAHI_BROWSER_ALL_FOR_NOW:
         case AVAHI_BROWSER_CACHE_EXHAUSTED:
             LOG(INFO, LOG_TAG) << "(Browser) " << (event == AVAHI_BROWSER_CACHE_EXHAUSTED ? "CACHE_EXHAUSTED" : "ALL_FOR_NOW") << "\n";
+            if (event == AVAHI_BROWSER_ALL_FOR_NOW)
+                browseAvahi->allForNow_ = true;
             break;
     }
 }
@@ -156,53 +205,371 @@ void BrowseAvahi::client_callback(AvahiClient* c, AvahiClientState state, AVAHI_
     assert(c);
 
     /* Called whenever the client or server state changes */
-    //    BrowseAvahi* browseAvahi = static_cast<BrowseAvahi*>(userdata);
+    auto* browseAvahi = static_cast<BrowseAvahi*>(userdata);
 
     if (state == AVAHI_CLIENT_FAILURE)
     {
         LOG(ERROR, LOG_TAG) << "Server connection failure: " << avahi_strerror(avahi_client_errno(c)) << "\n";
-        avahi_simple_poll_quit(simple_poll);
+        avahi_simple_poll_quit(browseAvahi->simple_poll_);
     }
 }
 
 
-bool BrowseAvahi::browse(const std::string& serviceName, mDNSResult& result, int timeout)
+bool BrowseAvahi::browse(const std::string& serviceName, const std::string& serviceType, AvahiIfIndex interface, bool firstHit,
+                         std::vector<mDNSResult>& results, int timeout)
 {
     try
     {
+        serviceName_ = serviceName;
+        firstHit_ = firstHit;
+        allForNow_ = false;
+        results_.clear();
+
         /* Allocate main loop object */
-        if ((simple_poll = avahi_simple_poll_new()) == nullptr)
+        if ((simple_poll_ = avahi_simple_poll_new()) == nullptr)
             throw SnapException("BrowseAvahi - Failed to create simple poll object");
 
         /* Allocate a new client */
         int error;
-        if ((client_ = avahi_client_new(avahi_simple_poll_get(simple_poll), static_cast<AvahiClientFlags>(0), client_callback, this, &error)) == nullptr)
+        if ((client_ = avahi_client_new(avahi_simple_poll_get(simple_poll_), static_cast<AvahiClientFlags>(0), client_callback, this, &error)) == nullptr)
             throw SnapException("BrowseAvahi - Failed to create client: " + std::string(avahi_strerror(error)));
 
         /* Create the service browser */
-        if ((sb_ = avahi_service_browser_new(client_, AVAHI_IF_UNSPEC, AVAHI_PROTO_INET, serviceName.c_str(), nullptr, static_cast<AvahiLookupFlags>(0),
+        if ((sb_ = avahi_service_browser_new(client_, interface, AVAHI_PROTO_UNSPEC, serviceType.c_str(), nullptr, static_cast<AvahiLookupFlags>(0),
                                              browse_callback, this)) == nullptr)
             throw SnapException("BrowseAvahi - Failed to create service browser: " + std::string(avahi_strerror(avahi_client_errno(client_))));
 
-        result_.valid = false;
-        while (timeout > 0)
+        if (timeout <= 0)
+            timeout = DEFAULT_TIMEOUT;
+        // Run until the first hit and the resolution delay for the other family, or until the browser is done and every resolver reported
+        auto now = std::chrono::steady_clock::now();
+        auto end = now + std::chrono::milliseconds(timeout);
+        while ((now < end) && !cancelled_)
         {
-            avahi_simple_poll_iterate(simple_poll, 100);
-            timeout -= 100;
-            if (result_.valid)
-            {
-                result = result_;
-                cleanUp();
-                return true;
-            }
+            auto until = std::min(end, now + std::chrono::milliseconds(100));
+            if (firstHit_ && !results_.empty())
+                until = std::min(until, firstResult_ + RESOLUTION_DELAY);
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count();
+            if (avahi_simple_poll_iterate(simple_poll_, static_cast<int>(std::max<long long>(wait, 0))) != 0)
+                break;
+            now = std::chrono::steady_clock::now();
+            if (firstHit_ && !results_.empty() && (resolvers_.empty() || (now >= firstResult_ + RESOLUTION_DELAY)))
+                break;
+            if (allForNow_ && resolvers_.empty())
+                break;
         }
 
         cleanUp();
+        results = results_;
+        return !results.empty();
+    }
+    catch (...)
+    {
+        cleanUp();
+        throw;
+    }
+}
+
+
+bool BrowseAvahi::browse(const std::string& serviceName, mDNSResult& result, int timeout)
+{
+    std::vector<mDNSResult> results;
+    if (!browse("", serviceName, AVAHI_IF_UNSPEC, true, results, timeout))
+        return false;
+    result = results.front();
+    return true;
+}
+
+
+bool BrowseAvahi::browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, mDNSResult& result, int timeout)
+{
+    std::vector<mDNSResult> results;
+    AvahiIfIndex interface = AVAHI_IF_UNSPEC;
+    if (!interfaceName.empty() && ((interface = static_cast<AvahiIfIndex>(if_nametoindex(interfaceName.c_str()))) == 0))
+    {
+        LOG(ERROR, LOG_TAG) << "Unknown interface: " << interfaceName << "\n";
         return false;
     }
+    if (!browse(serviceName, serviceType, interface, true, results, timeout))
+        return false;
+    result = results.front();
+    return true;
+}
+
+
+bool BrowseAvahi::browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, std::vector<mDNSResult>& results,
+                         int timeout)
+{
+    AvahiIfIndex interface = AVAHI_IF_UNSPEC;
+    if (!interfaceName.empty() && ((interface = static_cast<AvahiIfIndex>(if_nametoindex(interfaceName.c_str()))) == 0))
+    {
+        LOG(ERROR, LOG_TAG) << "Unknown interface: " << interfaceName << "\n";
+        return false;
+    }
+    return browse(serviceName, serviceType, interface, false, results, timeout);
+}
+
+
+void BrowseAvahi::asyncBrowse(boost::asio::io_context& io, const std::string& serviceName, const std::string& serviceType,
+                              const std::string& interfaceName, bool firstHit, int timeout, BrowseHandler handler)
+{
+    std::lock_guard<std::mutex> lock(asyncMutex_);
+    // join the threads of finished browses
+    for (auto it = asyncBrowses_.begin(); it != asyncBrowses_.end();)
+    {
+        if (!it->done)
+        {
+            ++it;
+            continue;
+        }
+        it->thread.join();
+        it = asyncBrowses_.erase(it);
+    }
+
+    // Avahi runs its own poll loop, so the browse is done by a private browser on a helper thread
+    asyncBrowses_.emplace_back();
+    AsyncBrowse* browse = &asyncBrowses_.back();
+    browse->browser.reset(new BrowseAvahi());
+    // io must not run out of work while only the helper thread is busy
+    browse->thread = std::thread([this, browse, work = boost::asio::make_work_guard(io), &io, serviceName, serviceType, interfaceName, firstHit, timeout,
+                                  handler]() mutable {
+        std::vector<mDNSResult> results;
+        boost::system::error_code ec;
+        try
+        {
+            // all addresses are reported, also in first-hit mode, so that the caller can race both families
+            AvahiIfIndex interface = AVAHI_IF_UNSPEC;
+            if (!interfaceName.empty() && ((interface = static_cast<AvahiIfIndex>(if_nametoindex(interfaceName.c_str()))) == 0))
+            {
+                LOG(ERROR, LOG_TAG) << "Unknown interface: " << interfaceName << "\n";
+                ec = boost::asio::error::no_such_device;
+            }
+            else if (!browse->browser->browse(serviceName, serviceType, interface, firstHit, results, timeout))
+                ec = boost::asio::error::host_not_found;
+        }
+        catch (const std::exception& e)
+        {
+            LOG(ERROR, LOG_TAG) << "Browse failed: " << e.what() << "\n";
+            ec = boost::asio::error::host_not_found;
+        }
+        // a cancelled browse belongs to a browser that is being destroyed, its handler may be gone as well
+        if (!browse->browser->cancelled_)
+            boost::asio::post(io, [handler, ec, results] { handler(ec, results); });
+        work.reset();
+        std::lock_guard<std::mutex> lock(asyncMutex_);
+        browse->done = true;
+    });
+}
+
+AvahiServiceWatcher::AvahiServiceWatcher(const std::string& serviceType, const std::string& interfaceName)
+    : ServiceWatcher(serviceType, interfaceName), poll_(nullptr), client_(nullptr), sb_(nullptr)
+{
+}
+
+
+AvahiServiceWatcher::~AvahiServiceWatcher()
+{
+    stop();
+}
+
+
+void AvahiServiceWatcher::cleanUp()
+{
+    for (auto& resolver : resolvers_)
+        avahi_service_resolver_free(resolver.second);
+    resolvers_.clear();
+    resolved_.clear();
+    owners_.clear();
+
+    if (sb_ != nullptr)
+        avahi_service_browser_free(sb_);
+    sb_ = nullptr;
+
+    if (client_ != nullptr)
+        avahi_client_free(client_);
+    client_ = nullptr;
+
+    if (poll_ != nullptr)
+        avahi_threaded_poll_free(poll_);
+    poll_ = nullptr;
+}
+
+
+void AvahiServiceWatcher::resolve_callback(AvahiServiceResolver* r, AvahiIfIndex interface, AvahiProtocol /*protocol*/, AvahiResolverEvent event,
+                                           const char* name, const char* type, const char* domain, const char* host_name, const AvahiAddress* address,
+                                           uint16_t port, AvahiStringList* txt, AvahiLookupResultFlags /*flags*/, void* userdata)
+{
+    auto* watcher = static_cast<AvahiServiceWatcher*>(userdata);
+    assert(r);
+
+    if (event == AVAHI_RESOLVER_FAILURE)
+    {
+        LOG(ERROR, LOG_TAG) << "(Watcher) Failed to resolve service '" << name << "' of type '" << type << "' in domain '" << domain
+                            << "': " << avahi_strerror(avahi_client_errno(avahi_service_resolver_get_client(r))) << "\n";
+        return;
+    }
+
+    char a[AVAHI_ADDRESS_STR_MAX];
+    avahi_address_snprint(a, sizeof(a), address);
+
+    mDNSService service;
+    service.name = name;
+    service.type = type;
+    service.domain = domain;
+    for (AvahiStringList* item = txt; item != nullptr; item = avahi_string_list_get_next(item))
+    {
+        char* key;
+        char* value;
+        if (avahi_string_list_get_pair(item, &key, &value, nullptr) != 0)
+            continue;
+        service.txt[key] = (value != nullptr) ? value : "";
+        avahi_free(key);
+        avahi_free(value);
+    }
+    service.result.host = host_name;
+    service.result.ip = a;
+    service.result.port = port;
+    service.result.ip_version = (service.result.ip.find(':') == std::string::npos) ? (IPVersion::IPv4) : (IPVersion::IPv6);
+    service.result.iface_idx = interface;
+    service.result.valid = true;
+    service.result.ttl = 0;
+    service.result.rtt = 0;
+
+    auto resolver = std::find_if(watcher->resolvers_.begin(), watcher->resolvers_.end(),
+                                 [r](const std::pair<const std::string, AvahiServiceResolver*>& entry) { return entry.second == r; });
+    if (resolver == watcher->resolvers_.end())
+        return;
+    const std::string& key = resolver->first;
+    watcher->resolved_[key] = service;
+    // a valid address is not replaced by the one of another family or interface, that would report an update for every answer
+    std::string& owner = watcher->owners_[service.name];
+    if (!owner.empty() && (owner != key))
+        return;
+    owner = key;
+    LOG(INFO, LOG_TAG) << "(Watcher) Service '" << name << "': " << host_name << ":" << port << " (" << a << ")\n";
+    watcher->update(service);
+}
+
+
+void AvahiServiceWatcher::browse_callback(AvahiServiceBrowser* b, AvahiIfIndex interface, AvahiProtocol protocol, AvahiBrowserEvent event, const char* name,
+                                          const char* type, const char* domain, AvahiLookupResultFlags /*flags*/, void* userdata)
+{
+    auto* watcher = static_cast<AvahiServiceWatcher*>(userdata);
+    assert(b);
+
+    // the service is announced once per interface and address family
+    std::string key = std::string(name) + "%" + cpt::to_string(interface) + "/" + cpt::to_string(protocol);
+    switch (event)
+    {
+        case AVAHI_BROWSER_FAILURE:
+            LOG(ERROR, LOG_TAG) << "(Watcher) " << avahi_strerror(avahi_client_errno(avahi_service_browser_get_client(b))) << "\n";
+            return;
+
+        case AVAHI_BROWSER_NEW:
+        {
+            LOG(INFO, LOG_TAG) << "(Watcher) NEW: service '" << name << "' of type '" << type << "' in domain '" << domain << "'\n";
+            if (watcher->resolvers_.find(key) != watcher->resolvers_.end())
+                break;
+            AvahiServiceResolver* resolver = avahi_service_resolver_new(watcher->client_, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC,
+                                                                        static_cast<AvahiLookupFlags>(0), resolve_callback, userdata);
+            if (resolver == nullptr)
+                LOG(ERROR, LOG_TAG) << "Failed to resolve service '" << name << "': " << avahi_strerror(avahi_client_errno(watcher->client_)) << "\n";
+            else
+                watcher->resolvers_[key] = resolver;
+            break;
+        }
+
+        case AVAHI_BROWSER_REMOVE:
+        {
+            LOG(INFO, LOG_TAG) << "(Watcher) REMOVE: service '" << name << "' of type '" << type << "' in domain '" << domain << "'\n";
+            auto it = watcher->resolvers_.find(key);
+            if (it != watcher->resolvers_.end())
+            {
+                avahi_service_resolver_free(it->second);
+                watcher->resolvers_.erase(it);
+            }
+            watcher->resolved_.erase(key);
+            // the service might still be present on another interface or address family
+            std::string prefix = std::string(name) + "%";
+            bool present = std::any_of(watcher->resolvers_.begin(), watcher->resolvers_.end(),
+                                       [&prefix](const std::pair<const std::string, AvahiServiceResolver*>& r) { return r.first.compare(0, prefix.size(), prefix) == 0; });
+            if (!present)
+            {
+                watcher->owners_.erase(name);
+                watcher->remove(name);
+                break;
+            }
+            // the reported address is gone, another resolver's address takes over
+            auto owner = watcher->owners_.find(name);
+            if ((owner == watcher->owners_.end()) || (owner->second != key))
+                break;
+            watcher->owners_.erase(owner);
+            auto other = std::find_if(watcher->resolved_.begin(), watcher->resolved_.end(),
+                                      [&prefix](const std::pair<const std::string, mDNSService>& r) { return r.first.compare(0, prefix.size(), prefix) == 0; });
+            if (other != watcher->resolved_.end())
+            {
+                watcher->owners_[name] = other->first;
+                watcher->update(other->second);
+            }
+            break;
+        }
+
+        case AVAHI_BROWSER_ALL_FOR_NOW:
+        case AVAHI_BROWSER_CACHE_EXHAUSTED:
+            break;
+    }
+}
+
+
+void AvahiServiceWatcher::client_callback(AvahiClient* c, AvahiClientState state, void* /*userdata*/)
+{
+    assert(c);
+    if (state == AVAHI_CLIENT_FAILURE)
+        LOG(ERROR, LOG_TAG) << "(Watcher) Server connection failure: " << avahi_strerror(avahi_client_errno(c)) << "\n";
+}
+
+
+void AvahiServiceWatcher::start()
+{
+    if (poll_ != nullptr)
+        return;
+
+    try
+    {
+        AvahiIfIndex interface = AVAHI_IF_UNSPEC;
+        if (!interfaceName_.empty())
+        {
+            interface = static_cast<AvahiIfIndex>(if_nametoindex(interfaceName_.c_str()));
+            if (interface == 0)
+                throw SnapException("AvahiServiceWatcher - Unknown interface: " + interfaceName_);
+        }
+
+        if ((poll_ = avahi_threaded_poll_new()) == nullptr)
+            throw SnapException("AvahiServiceWatcher - Failed to create threaded poll object");
+
+        int error;
+        if ((client_ = avahi_client_new(avahi_threaded_poll_get(poll_), static_cast<AvahiClientFlags>(0), client_callback, this, &error)) == nullptr)
+            throw SnapException("AvahiServiceWatcher - Failed to create client: " + std::string(avahi_strerror(error)));
+
+        if ((sb_ = avahi_service_browser_new(client_, interface, AVAHI_PROTO_UNSPEC, serviceType_.c_str(), nullptr, static_cast<AvahiLookupFlags>(0),
+                                             browse_callback, this)) == nullptr)
+            throw SnapException("AvahiServiceWatcher - Failed to create service browser: " + std::string(avahi_strerror(avahi_client_errno(client_))));
+
+        if (avahi_threaded_poll_start(poll_) < 0)
+            throw SnapException("AvahiServiceWatcher - Failed to start threaded poll");
+    }
     catch (...)
     {
         cleanUp();
         throw;
     }
 }
+
+
+void AvahiServiceWatcher::stop()
+{
+    if (poll_ == nullptr)
+        return;
+    avahi_threaded_poll_stop(poll_);
+    cleanUp();
+}
@@ -24,8 +24,16 @@
 #include <avahi-common/error.h>
 #include <avahi-common/malloc.h>
 #include <avahi-common/simple-watch.h>
+#include <avahi-common/thread-watch.h>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <set>
+#include <thread>
 
 class BrowseAvahi;
+class AvahiServiceWatcher;
 
 #include "browse_mdns.hpp"
 
@@ -35,8 +43,26 @@ public:
     BrowseAvahi();
     ~BrowseAvahi();
     bool browse(const std::string& serviceName, mDNSResult& result, int timeout) override;
+    bool browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, mDNSResult& result, int timeout) override;
+    bool browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, std::vector<mDNSResult>& results, int timeout) override;
+    /// Runs a blocking browse on a helper thread, the result is posted to io
+    /// Browses that are still running when the browser is destroyed are cancelled, their handlers are not called.
+    void asyncBrowse(boost::asio::io_context& io, const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName,
+                     bool firstHit, int timeout, BrowseHandler handler) override;
 
 private:
+    /// A browse of asyncBrowse, the thread is joined once it's done or the owning browser is destroyed
+    struct AsyncBrowse
+    {
+        std::unique_ptr<BrowseAvahi> browser;
+        std::thread thread;
+        bool done = false;
+    };
+
+    /// Browse for serviceType and resolve every service named serviceName (all if empty)
+    /// @param firstHit stop as soon as the first service is resolved
+    bool browse(const std::string& serviceName, const std::string& serviceType, AvahiIfIndex interface, bool firstHit, std::vector<mDNSResult>& results,
+                int timeout);
     void cleanUp();
     static void resolve_callback(AvahiServiceResolver* r, AVAHI_GCC_UNUSED AvahiIfIndex interface, AVAHI_GCC_UNUSED AvahiProtocol protocol,
                                  AvahiResolverEvent event, const char* name, const char* type, const char* domain, const char* host_name,
@@ -45,9 +71,53 @@ private:
     static void browse_callback(AvahiServiceBrowser* b, AvahiIfIndex interface, AvahiProtocol protocol, AvahiBrowserEvent event, const char* name,
                                 const char* type, const char* domain, AVAHI_GCC_UNUSED AvahiLookupResultFlags flags, void* userdata);
     static void client_callback(AvahiClient* c, AvahiClientState state, AVAHI_GCC_UNUSED void* userdata);
+    AvahiSimplePoll* simple_poll_;
+    AvahiClient* client_;
+    AvahiServiceBrowser* sb_;
+    /// resolvers that didn't report yet, with their start time for the rtt
+    std::map<AvahiServiceResolver*, std::chrono::steady_clock::time_point> resolvers_;
+    /// names of the services that are already being resolved
+    std::set<std::string> names_;
+    std::vector<mDNSResult> results_;
+    std::string serviceName_;
+    bool firstHit_;
+    bool allForNow_;
+    /// arrival of the first result, the other family gets RESOLUTION_DELAY from there
+    std::chrono::steady_clock::time_point firstResult_;
+    /// ends a running browse within one poll iteration
+    std::atomic<bool> cancelled_;
+    /// guards asyncBrowses_
+    std::mutex asyncMutex_;
+    std::list<AsyncBrowse> asyncBrowses_;
+};
+
+class AvahiServiceWatcher : public ServiceWatcher
+{
+public:
+    AvahiServiceWatcher(const std::string& serviceType, const std::string& interfaceName);
+    ~AvahiServiceWatcher() override;
+
+    void start() override;
+    void stop() override;
+
+private:
+    void cleanUp();
+    static void resolve_callback(AvahiServiceResolver* r, AvahiIfIndex interface, AvahiProtocol protocol, AvahiResolverEvent event, const char* name,
+                                 const char* type, const char* domain, const char* host_name, const AvahiAddress* address, uint16_t port,
+                                 AvahiStringList* txt, AvahiLookupResultFlags flags, void* userdata);
+    static void browse_callback(AvahiServiceBrowser* b, AvahiIfIndex interface, AvahiProtocol protocol, AvahiBrowserEvent event, const char* name,
+                                const char* type, const char* domain, AvahiLookupResultFlags flags, void* userdata);
+    static void client_callback(AvahiClient* c, AvahiClientState state, void* userdata);
+
+    AvahiThreadedPoll* poll_;
     AvahiClient* client_;
-    mDNSResult result_;
     AvahiServiceBrowser* sb_;
+    /// one resolver per service name, interface and address family, keyed "name%interface/protocol", they stay open to report changes
+    std::map<std::string, AvahiServiceResolver*> resolvers_;
+    /// last result of each resolver, by resolver key
+    std::map<std::string, mDNSService> resolved_;
+    /// key of the resolver whose address is reported for a service name
+    std::map<std::string, std::string> owners_;
 };
 
 #endif
@@ -1,19 +1,29 @@
 #include "browse_bonjour.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <deque>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <set>
+#include <vector>
 #ifdef WINDOWS
 #include <WinSock2.h>
 #include <Ws2tcpip.h>
 #else
 #include <netdb.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 #include <net/if.h>
 #include <map>
 #endif
 
 #include "common/aixlog.hpp"
+#include "common/asio_reactor.hpp"
+#include "common/reactor.hpp"
 #include "common/snap_exception.hpp"
 
 using namespace std;
@@ -24,7 +34,8 @@ struct DNSServiceRefDeleter
 {
     void operator()(DNSServiceRef* ref)
     {
-        DNSServiceRefDeallocate(*ref);
+        if (*ref != nullptr)
+            DNSServiceRefDeallocate(*ref);
         delete ref;
     }
 };
@@ -156,167 +167,507 @@ struct mDNSResolve_
 };
 
 #define CHECKED(err)                                                                                                                                           \
-    if ((err) != kDNSServiceErr_NoError)                                                                                                                       \
-        throw SnapException(BonjourGetError(err) + ":" + to_string(__LINE__));
+    do                                                                                                                                                         \
+    {                                                                                                                                                          \
+        DNSServiceErrorType error_ = (err);                                                                                                                    \
+        if (error_ != kDNSServiceErr_NoError)                                                                                                                  \
+            throw SnapException(BonjourGetError(error_) + ":" + to_string(__LINE__));                                                                          \
+    } while (0)
 
-void runService(const DNSServiceHandle& service)
+using Clock = std::chrono::steady_clock;
+
+/// An address is usable if it is neither the unspecified address nor an IPv4 "this network" address
+static bool isUsableAddress(const sockaddr* address)
 {
-    if (!*service)
-        return;
+    if (address->sa_family == AF_INET)
+    {
+        auto addr = ntohl(reinterpret_cast<const sockaddr_in*>(address)->sin_addr.s_addr);
+        return (addr >> 24) != 0;
+    }
+    if (address->sa_family == AF_INET6)
+        return !IN6_IS_ADDR_UNSPECIFIED(&reinterpret_cast<const sockaddr_in6*>(address)->sin6_addr);
+    return false;
+}
+
+/// A browse reply is expected within this interval of the previous one
+static constexpr auto BROWSE_IDLE_TIMEOUT = 300ms;
+/// Max time to wait for a resolve reply after the resolve has been started
+static constexpr auto RESOLVE_TIMEOUT = 300ms;
+/// Max time to wait for an address after the lookup has been started
+static constexpr auto ADDRINFO_TIMEOUT = 200ms;
+/// Time the other address family gets after the first address arrived (RFC 8305 "Resolution Delay")
+static constexpr auto RESOLUTION_DELAY = 50ms;
+
+
+/// Event driven browse -> resolve -> address lookup pipeline
+/// The resolve of a service is started as soon as its browse reply arrives and the address lookup
+/// as soon as its resolve reply arrives. All pending DNSServiceRefs and their deadlines are
+/// multiplexed on one Reactor: either a private epoll Reactor driven by run(), or a Reactor
+/// that is driven by someone else, e.g. an AsioReactor on the client's io_context.
+class BonjourPipeline
+{
+public:
+    using ResultHandler = std::function<void(const mDNSResult&)>;
+    using DoneHandler = std::function<void()>;
+
+    /// c'tor for a pipeline on its own epoll Reactor, see run()
+    /// @param serviceName only services with this name are resolved, empty for all
+    /// @param serviceType the service type to browse for, e.g. "_controller._tcp."
+    /// @param interfaceIndex index of the interface to browse on, 0 for all
+    /// @param handler called for every resolved address
+    /// @param firstHit stop all outstanding operations after the first usable address
+    BonjourPipeline(const string& serviceName, const string& serviceType, uint32_t interfaceIndex, ResultHandler handler, bool firstHit = false)
+        : BonjourPipeline(new EpollReactor(), serviceName, serviceType, interfaceIndex, std::move(handler), firstHit)
+    {
+    }
 
-    auto socket = DNSServiceRefSockFD(*service);
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(socket, &set);
+    /// c'tor for a pipeline on an external reactor, see start()
+    BonjourPipeline(Reactor& reactor, const string& serviceName, const string& serviceType, uint32_t interfaceIndex, ResultHandler handler,
+                    bool firstHit = false)
+        : reactor_(reactor), serviceName_(serviceName), serviceType_(serviceType), interfaceIndex_(interfaceIndex), handler_(std::move(handler)),
+          firstHit_(firstHit), stopped_(false), timedOut_(false), completed_(false), browseIdle_(false), browseTimer_(0), endTimer_(0)
+    {
+    }
+
+    ~BonjourPipeline()
+    {
+        cancel();
+    }
 
-    timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 500000;
+    /// Browse until no more replies arrive and all started resolves and lookups are finished or timed out
+    /// @param timeout overall limit in ms, <= 0 for no limit
+    void run(int timeout);
 
-    while (select(FD_SETSIZE, &set, NULL, NULL, &timeout))
+    /// Start browsing, done is called from within a reactor handler once the pipeline is finished
+    /// @param timeout overall limit in ms, <= 0 for no limit
+    void start(int timeout, DoneHandler done);
+
+private:
+    enum class Stage
+    {
+        Resolving,
+        Resolved,
+        LookingUp,
+        Done,
+        Failed
+    };
+
+    /// One browsed service instance, tracked from its browse reply to the resolved address
+    struct Service
+    {
+        BonjourPipeline* pipeline;
+        mDNSReply reply;
+        mDNSResolve_ resolve;
+        mDNSResult result;
+        DNSServiceHandle ref;
+        Stage stage;
+        /// deadline of the current stage
+        size_t timer;
+        /// start of the resolve, for the rtt
+        Clock::time_point started;
+        /// kDNSServiceProtocol_IPv4/IPv6 flags of the families that have been reported
+        uint32_t families;
+    };
+
+    bool pending(const Service& service) const
     {
-        CHECKED(DNSServiceProcessResult(*service));
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 500000;
+        return (service.stage == Stage::Resolving) || (service.stage == Stage::LookingUp);
     }
-}
 
-void runServiceWithTimeout(const DNSServiceHandle& service, double timeoutMs)
+    BonjourPipeline(EpollReactor* reactor, const string& serviceName, const string& serviceType, uint32_t interfaceIndex, ResultHandler handler,
+                    bool firstHit)
+        : BonjourPipeline(*reactor, serviceName, serviceType, interfaceIndex, std::move(handler), firstHit)
+    {
+        ownReactor_.reset(reactor);
+    }
+
+    /// Watch ref on the reactor and dispatch its results to process
+    void watch(const DNSServiceHandle& ref, std::function<void()> process);
+    /// Arm a timer on the reactor, the pipeline advances after handler ran
+    size_t addTimer(const Clock::time_point& deadline, std::function<void()> handler);
+    /// Stop watching ref and deallocate it
+    void release(DNSServiceHandle& ref);
+    void process(Service& service);
+    void startResolve(Service& service);
+    void startLookup(Service& service);
+    /// The lookup of service is complete
+    void done(Service& service);
+    /// Move services to their next stage and release finished DNSServiceRefs
+    void advance();
+    bool finished() const;
+    /// Advance the pipeline after an event and complete it once it is finished
+    void afterEvent();
+    /// Stop watching and release everything that is still outstanding
+    void cancel();
+    /// Cancel and call the done handler
+    void complete();
+
+    static void browseReply(DNSServiceRef service, DNSServiceFlags flags, uint32_t interfaceIndex, DNSServiceErrorType errorCode, const char* replyName,
+                            const char* regtype, const char* replyDomain, void* context);
+    static void resolveReply(DNSServiceRef service, DNSServiceFlags flags, uint32_t interfaceIndex, DNSServiceErrorType errorCode, const char* fullName,
+                             const char* hosttarget, uint16_t port, uint16_t txtLen, const unsigned char* txtRecord, void* context);
+    static void addrInfoReply(DNSServiceRef service, DNSServiceFlags flags, uint32_t interfaceIndex, DNSServiceErrorType errorCode, const char* hostname,
+                              const sockaddr* address, uint32_t ttl, void* context);
+
+    /// only set if the pipeline runs on its own reactor
+    std::unique_ptr<EpollReactor> ownReactor_;
+    Reactor& reactor_;
+    string serviceName_;
+    string serviceType_;
+    uint32_t interfaceIndex_;
+    ResultHandler handler_;
+    bool firstHit_;
+    bool stopped_;
+    bool timedOut_;
+    bool completed_;
+    DoneHandler done_;
+
+    DNSServiceHandle browse_;
+    bool browseIdle_;
+    size_t browseTimer_;
+    size_t endTimer_;
+    /// unique_ptr, because the Service address is passed as context to DNS-SD
+    deque<std::unique_ptr<Service>> services_;
+};
+
+
+void BonjourPipeline::browseReply(DNSServiceRef /*service*/, DNSServiceFlags flags, uint32_t interfaceIndex, DNSServiceErrorType errorCode,
+                                  const char* replyName, const char* regtype, const char* replyDomain, void* context)
 {
-    if (!*service)
+    auto pipeline = static_cast<BonjourPipeline*>(context);
+    if (errorCode != kDNSServiceErr_NoError)
+    {
+        LOG(ERROR, LOG_TAG) << "Browse failed: " << BonjourGetError(errorCode) << endl;
         return;
+    }
 
-    auto socket = DNSServiceRefSockFD(*service);
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(socket, &set);
+    LOG(NOTICE, LOG_TAG) << "Browsed service: " << replyName << "." << regtype << replyDomain << " InterfaceIndex: " << interfaceIndex << endl;
+    pipeline->reactor_.cancelTimer(pipeline->browseTimer_);
+    pipeline->browseTimer_ = pipeline->addTimer(Clock::now() + BROWSE_IDLE_TIMEOUT, [pipeline] { pipeline->browseIdle_ = true; });
+    if ((flags & kDNSServiceFlagsAdd) == 0)
+        return;
+
+    // Remove the unexpected service
+    if (!pipeline->serviceName_.empty() && (pipeline->serviceName_ != replyName))
+        return;
 
-    timeval timeout;
-    timeout.tv_sec = (int)timeoutMs / 1000;
-    timeout.tv_usec = (int)(timeoutMs*1000) % 1000000;
+    // Remove the repeated item of the same name
+    for (const auto& service : pipeline->services_)
+        if (service->reply.name == replyName)
+            return;
 
-    while (select(FD_SETSIZE, &set, NULL, NULL, &timeout))
+    pipeline->services_.emplace_back(new Service{pipeline, mDNSReply{string(replyName), string(regtype), string(replyDomain)}, mDNSResolve_{},
+                                                 mDNSResult{IPVersion::IPv4, 0, "", "", 0, false, 0, 0}, nullptr, Stage::Resolving, 0, Clock::now(), 0});
+    pipeline->startResolve(*pipeline->services_.back());
+}
+
+
+void BonjourPipeline::resolveReply(DNSServiceRef /*service*/, DNSServiceFlags /*flags*/, uint32_t interfaceIndex, DNSServiceErrorType errorCode,
+                                   const char* fullName, const char* hosttarget, uint16_t port, uint16_t txtLen, const unsigned char* txtRecord,
+                                   void* context)
+{
+    auto service = static_cast<Service*>(context);
+    if (service->stage != Stage::Resolving)
+        return;
+
+    if (errorCode != kDNSServiceErr_NoError)
     {
-        CHECKED(DNSServiceProcessResult(*service));
-        timeout.tv_sec = (int)timeoutMs / 1000;
-        timeout.tv_usec = (int)(timeoutMs*1000) % 1000000;
+        LOG(ERROR, LOG_TAG) << "Resolve of " << service->reply.name << " failed: " << BonjourGetError(errorCode) << endl;
+        service->stage = Stage::Failed;
+        return;
     }
+
+    service->resolve = mDNSResolve_{interfaceIndex, string(fullName), string(hosttarget), ntohs(port), txtLen, vector<char>(txtRecord, txtRecord + txtLen)};
+    service->stage = Stage::Resolved;
+    LOG(NOTICE, LOG_TAG) << "Resolved service: Fullname: <" << fullName << "> Host: <" << hosttarget << "> port: <" << ntohs(port)
+                         << "> interfaceIndex: <" << interfaceIndex << "> txtLen: <" << txtLen << ">" << endl;
 }
 
-bool getInterfaceNameIndex(std::map<unsigned int, std::string>& results)
+
+void BonjourPipeline::addrInfoReply(DNSServiceRef /*service*/, DNSServiceFlags flags, uint32_t interfaceIndex, DNSServiceErrorType errorCode,
+                                    const char* hostname, const sockaddr* address, uint32_t ttl, void* context)
 {
-    struct if_nameindex *head, *ifni;
-    ifni = if_nameindex();
-    head = ifni;
+    auto service = static_cast<Service*>(context);
+    if (service->stage != Stage::LookingUp)
+        return;
 
-    if (head == NULL) {
-        LOG(ERROR, LOG_TAG) << "if_nameindex()" << endl;
-        return false;
+    if (errorCode != kDNSServiceErr_NoError)
+    {
+        LOG(ERROR, LOG_TAG) << "Address lookup of " << service->resolve.host << " failed: " << BonjourGetError(errorCode) << endl;
+        // the other family might have answered already
+        if (service->families == 0)
+            service->stage = Stage::Failed;
+        return;
     }
+    if ((flags & kDNSServiceFlagsAdd) == 0)
+        return;
 
-    while (ifni->if_index != 0) {
-        results.insert(pair <unsigned int, std::string> (ifni->if_index, std::string(ifni->if_name)));
-        LOG(NOTICE, LOG_TAG) << "Interface: " << ifni->if_index << " : " << ifni->if_name << endl;
-        ifni++;
+    char hostIP[NI_MAXHOST];
+    char hostService[NI_MAXSERV];
+    socklen_t addressLen = (address->sa_family == AF_INET6) ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+    if (getnameinfo(address, addressLen, hostIP, sizeof(hostIP), hostService, sizeof(hostService), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+    {
+        LOG(ERROR, LOG_TAG) << "DNS resolve failed" << endl;
+        return;
     }
+    LOG(NOTICE, LOG_TAG) << "DNS resolved: hostname: " << hostname << " IP: " << hostIP << " interfaceIndex: " << interfaceIndex << endl;
 
-    if_freenameindex(head);
-    head = NULL;
-    ifni = NULL;
+    if (!isUsableAddress(address))
+    {
+        LOG(WARNING, LOG_TAG) << "Ignoring unusable address " << hostIP << " of " << hostname << endl;
+        return;
+    }
 
-    return true;
+    // one result per address, so that both families can be raced by the caller
+    mDNSResult result = service->result;
+    result.host = string(hostname);
+    result.ip = string(hostIP);
+    result.ip_version = (address->sa_family == AF_INET) ? (IPVersion::IPv4) : (IPVersion::IPv6);
+    result.iface_idx = static_cast<int>(interfaceIndex);
+    result.ttl = ttl;
+    result.rtt = static_cast<uint32_t>(chrono::duration_cast<chrono::microseconds>(Clock::now() - service->started).count());
+    result.valid = true;
+
+    auto pipeline = service->pipeline;
+    pipeline->handler_(result);
+
+    bool first = (service->families == 0);
+    service->families |= (address->sa_family == AF_INET) ? kDNSServiceProtocol_IPv4 : kDNSServiceProtocol_IPv6;
+    if (service->families == (kDNSServiceProtocol_IPv4 | kDNSServiceProtocol_IPv6))
+        pipeline->done(*service);
+    else if (first)
+    {
+        // RFC 8305: give the other family a short time to answer instead of waiting for the lookup timeout
+        pipeline->reactor_.cancelTimer(service->timer);
+        service->timer = pipeline->addTimer(Clock::now() + RESOLUTION_DELAY, [pipeline, service] {
+            if (service->stage == Stage::LookingUp)
+                pipeline->done(*service);
+        });
+    }
 }
 
-bool BrowseBonjour::browse(const string& serviceName, mDNSResult& result, int /*timeout*/)
+
+void BonjourPipeline::done(Service& service)
 {
-    result.valid = false;
-    // Discover
-    deque<mDNSReply> replyCollection;
+    service.stage = Stage::Done;
+    if (firstHit_)
+        stopped_ = true;
+}
+
+
+void BonjourPipeline::watch(const DNSServiceHandle& ref, std::function<void()> process)
+{
+    reactor_.add(DNSServiceRefSockFD(*ref), [this, process](uint32_t /*events*/) {
+        process();
+        afterEvent();
+    });
+}
+
+
+size_t BonjourPipeline::addTimer(const Clock::time_point& deadline, std::function<void()> handler)
+{
+    return reactor_.addTimer(deadline, [this, handler] {
+        handler();
+        afterEvent();
+    });
+}
+
+
+void BonjourPipeline::release(DNSServiceHandle& ref)
+{
+    if (!ref)
+        return;
+    if (*ref != nullptr)
+        reactor_.remove(DNSServiceRefSockFD(*ref));
+    ref.reset();
+}
+
+
+void BonjourPipeline::process(Service& service)
+{
+    // more results might be ready after the first hit within the same reactor run
+    if (stopped_ || !pending(service))
+        return;
+    auto err = DNSServiceProcessResult(*service.ref);
+    if (err != kDNSServiceErr_NoError)
     {
-        DNSServiceHandle service(new DNSServiceRef(NULL));
-        CHECKED(DNSServiceBrowse(
-            service.get(), 0, 0, serviceName.c_str(), "local.",
-            [](DNSServiceRef /*service*/, DNSServiceFlags /*flags*/, uint32_t /*interfaceIndex*/, DNSServiceErrorType errorCode, const char* serviceName,
-               const char* regtype, const char* replyDomain, void* context) {
-                auto replyCollection = static_cast<deque<mDNSReply>*>(context);
+        LOG(ERROR, LOG_TAG) << "Failed to process result for " << service.reply.name << ": " << BonjourGetError(err) << endl;
+        service.stage = Stage::Failed;
+    }
+}
 
-                CHECKED(errorCode);
-                replyCollection->push_back(mDNSReply{string(serviceName), string(regtype), string(replyDomain)});
-            },
-            &replyCollection));
 
-        runService(service);
+void BonjourPipeline::startResolve(Service& service)
+{
+    LOG(NOTICE, LOG_TAG) << "Resolving : " << service.reply.name << "." << service.reply.regtype << service.reply.domain << endl;
+    service.ref.reset(new DNSServiceRef(NULL));
+    // called from within reactor handlers, so failures are not thrown but fail the service
+    auto err = DNSServiceResolve(service.ref.get(), 0, interfaceIndex_, service.reply.name.c_str(), service.reply.regtype.c_str(),
+                                 service.reply.domain.c_str(), resolveReply, &service);
+    if (err != kDNSServiceErr_NoError)
+    {
+        LOG(ERROR, LOG_TAG) << "Failed to resolve " << service.reply.name << ": " << BonjourGetError(err) << endl;
+        service.ref.reset();
+        service.stage = Stage::Failed;
+        return;
     }
+    watch(service.ref, [this, &service] { process(service); });
+    service.timer = addTimer(Clock::now() + RESOLVE_TIMEOUT, [&service] {
+        if (service.stage != Stage::Resolving)
+            return;
+        LOG(WARNING, LOG_TAG) << "Timeout while resolving " << service.reply.name << endl;
+        service.stage = Stage::Failed;
+    });
+}
 
-    // Resolve
-    deque<mDNSResolve> resolveCollection;
+
+void BonjourPipeline::startLookup(Service& service)
+{
+    LOG(NOTICE, LOG_TAG) << "DNS/mDNS Resolving. interfaceIndex: " << service.resolve.ifIndex << " host: " << service.resolve.host
+                         << " fullName: " << service.resolve.fullName << endl;
+    service.result.port = service.resolve.port;
+    service.ref.reset(new DNSServiceRef(NULL));
+    auto err = DNSServiceGetAddrInfo(service.ref.get(), kDNSServiceFlagsLongLivedQuery, service.resolve.ifIndex,
+                                     kDNSServiceProtocol_IPv4 | kDNSServiceProtocol_IPv6, service.resolve.host.c_str(), addrInfoReply, &service);
+    if (err != kDNSServiceErr_NoError)
     {
-        DNSServiceHandle service(new DNSServiceRef(NULL));
-        for (auto& reply : replyCollection)
-            CHECKED(DNSServiceResolve(
-                service.get(), 0, 0, reply.name.c_str(), reply.regtype.c_str(), reply.domain.c_str(),
-                [](DNSServiceRef /*service*/, DNSServiceFlags /*flags*/, uint32_t /*interfaceIndex*/, DNSServiceErrorType errorCode, const char* /*fullName*/,
-                   const char* hosttarget, uint16_t port, uint16_t /*txtLen*/, const unsigned char* /*txtRecord*/, void* context) {
-                    auto resultCollection = static_cast<deque<mDNSResolve>*>(context);
+        LOG(ERROR, LOG_TAG) << "Failed to look up " << service.resolve.host << ": " << BonjourGetError(err) << endl;
+        service.ref.reset();
+        service.stage = Stage::Failed;
+        return;
+    }
+    service.stage = Stage::LookingUp;
+    watch(service.ref, [this, &service] { process(service); });
+    service.timer = addTimer(Clock::now() + ADDRINFO_TIMEOUT, [&service] {
+        if (service.stage != Stage::LookingUp)
+            return;
+        LOG(WARNING, LOG_TAG) << "Timeout while looking up " << service.reply.name << endl;
+        service.stage = Stage::Failed;
+    });
+}
 
-                    CHECKED(errorCode);
-                    resultCollection->push_back(mDNSResolve{string(hosttarget), ntohs(port)});
-                },
-                &resolveCollection));
 
-        runService(service);
+void BonjourPipeline::advance()
+{
+    if (browse_ && browseIdle_)
+        release(browse_);
+
+    for (auto& service : services_)
+    {
+        if (pending(*service) || !service->ref)
+            continue;
+        reactor_.cancelTimer(service->timer);
+        release(service->ref);
+        if (service->stage == Stage::Resolved)
+            startLookup(*service);
     }
+}
+
+
+bool BonjourPipeline::finished() const
+{
+    if (stopped_ || timedOut_)
+        return true;
+    if (browse_)
+        return false;
+    return std::none_of(services_.begin(), services_.end(), [this](const std::unique_ptr<Service>& service) { return pending(*service); });
+}
+
 
-    // DNS/mDNS Resolve
-    deque<mDNSResult> resultCollection(resolveCollection.size(), mDNSResult{IPVersion::IPv4, 0, "", "", 0, false});
+void BonjourPipeline::afterEvent()
+{
+    if (completed_)
+        return;
+    advance();
+    if (finished())
+        complete();
+}
+
+
+void BonjourPipeline::cancel()
+{
+    reactor_.cancelTimer(browseTimer_);
+    reactor_.cancelTimer(endTimer_);
+    release(browse_);
+    for (auto& service : services_)
     {
-        DNSServiceHandle service(new DNSServiceRef(NULL));
-        unsigned i = 0;
-        for (auto& resolve : resolveCollection)
+        reactor_.cancelTimer(service->timer);
+        release(service->ref);
+    }
+}
+
+
+void BonjourPipeline::complete()
+{
+    completed_ = true;
+    // Cancel everything that is still outstanding, e.g. after the first hit
+    cancel();
+    // the done handler might delete the pipeline
+    DoneHandler done = std::move(done_);
+    done_ = nullptr;
+    if (done)
+        done();
+}
+
+
+void BonjourPipeline::start(int timeout, DoneHandler done)
+{
+    done_ = std::move(done);
+    auto now = Clock::now();
+    browse_.reset(new DNSServiceRef(NULL));
+    CHECKED(DNSServiceBrowse(browse_.get(), 0, interfaceIndex_, serviceType_.c_str(), "local.", browseReply, this));
+    watch(browse_, [this] {
+        if (stopped_)
+            return;
+        auto err = DNSServiceProcessResult(*browse_);
+        if (err != kDNSServiceErr_NoError)
         {
-            resultCollection[i].port = resolve.port;
-            CHECKED(DNSServiceGetAddrInfo(
-                service.get(), kDNSServiceFlagsLongLivedQuery, 0, kDNSServiceProtocol_IPv4, resolve.fullName.c_str(),
-                [](DNSServiceRef /*service*/, DNSServiceFlags /*flags*/, uint32_t interfaceIndex, DNSServiceErrorType /*errorCode*/, const char* hostname,
-                   const sockaddr* address, uint32_t /*ttl*/, void* context) {
-                    auto result = static_cast<mDNSResult*>(context);
-
-                    result->host = string(hostname);
-                    result->ip_version = (address->sa_family == AF_INET) ? (IPVersion::IPv4) : (IPVersion::IPv6);
-                    result->iface_idx = static_cast<int>(interfaceIndex);
-
-                    char hostIP[NI_MAXHOST];
-                    char hostService[NI_MAXSERV];
-                    if (getnameinfo(address, sizeof(*address), hostIP, sizeof(hostIP), hostService, sizeof(hostService), NI_NUMERICHOST | NI_NUMERICSERV) == 0)
-                        result->ip = string(hostIP);
-                    else
-                        return;
-                    result->valid = true;
-                },
-                &resultCollection[i++]));
+            LOG(ERROR, LOG_TAG) << "Failed to process browse result: " << BonjourGetError(err) << endl;
+            browseIdle_ = true;
         }
-        runService(service);
-    }
+    });
+    browseTimer_ = addTimer(now + BROWSE_IDLE_TIMEOUT, [this] { browseIdle_ = true; });
+    if (timeout > 0)
+        endTimer_ = addTimer(now + chrono::milliseconds(timeout), [this] { timedOut_ = true; });
+}
 
-    resultCollection.erase(std::remove_if(resultCollection.begin(), resultCollection.end(), [](const mDNSResult& res) { return res.ip.empty(); }),
-                           resultCollection.end());
 
-    if (resultCollection.empty())
+void BonjourPipeline::run(int timeout)
+{
+    bool done = false;
+    start(timeout, [&done] { done = true; });
+    while (!done)
+        ownReactor_->runOnce();
+}
+
+
+bool getInterfaceNameIndex(std::map<unsigned int, std::string>& results)
+{
+    struct if_nameindex *head, *ifni;
+    ifni = if_nameindex();
+    head = ifni;
+
+    if (head == NULL) {
+        LOG(ERROR, LOG_TAG) << "if_nameindex()" << endl;
         return false;
+    }
 
-    if (resultCollection.size() > 1)
-        LOG(NOTICE, LOG_TAG) << "Multiple servers found.  Using first" << endl;
+    while (ifni->if_index != 0) {
+        results.insert(pair <unsigned int, std::string> (ifni->if_index, std::string(ifni->if_name)));
+        LOG(NOTICE, LOG_TAG) << "Interface: " << ifni->if_index << " : " << ifni->if_name << endl;
+        ifni++;
+    }
 
-    result = resultCollection.front();
+    if_freenameindex(head);
+    head = NULL;
+    ifni = NULL;
 
     return true;
 }
 
-bool BrowseBonjour::browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, std::vector<mDNSResult>& results, int /*timeout*/)
+/// Translate an interface name into its index, an empty name means all interfaces (index 0)
+bool getInterfaceIndex(const std::string& interfaceName, uint32_t& interfaceIndex)
 {
-    LOG(NOTICE, LOG_TAG) << " browse"<< endl;
-
-    uint32_t interfaceIndex;
     if (interfaceName.empty()) {
         interfaceIndex = 0;
     } else {
@@ -332,134 +683,43 @@ bool BrowseBonjour::browse(const std::string& serviceName, const std::string& se
             return false;
         }
     }
+    return true;
+}
 
-    LOG(NOTICE, LOG_TAG) << "try to browse: <" << serviceName.c_str() << ">.<" << serviceType.c_str() << "><local.> interfaceName: <" << interfaceName.c_str() << "> interfaceIndex: <" << interfaceIndex << ">" << endl;
-    // Discover
-    deque<mDNSReply> replyCollection;
-    {
-        DNSServiceHandle service(new DNSServiceRef(NULL));
-        CHECKED(DNSServiceBrowse(
-            service.get(), 0, interfaceIndex, serviceType.c_str(), "local.",
-            [](DNSServiceRef /*service*/, DNSServiceFlags /*flags*/, uint32_t interfaceIndex, DNSServiceErrorType errorCode, const char* replyName,
-               const char* regtype, const char* replyDomain, void* context) {
-                auto replyCollection = static_cast<deque<mDNSReply>*>(context);
-                LOG(NOTICE) << "Browsed service: "<< replyName << "." << regtype << replyDomain << " InterfaceIndex: " << interfaceIndex << endl;
-                CHECKED(errorCode);
-                replyCollection->push_back(mDNSReply{string(replyName), string(regtype), string(replyDomain)});
-            },
-            &replyCollection));
-
-        runServiceWithTimeout(service, 300);
-    }
-
-    // Remove
-    deque<mDNSReply>::iterator it,it1;
-    {
-        // Remove the unexpected service
-        if (!serviceName.empty()) {
-            for (it = replyCollection.begin(); it != replyCollection.end();) {
-                if (it->name != serviceName)
-                    it = replyCollection.erase(it);
-                else
-                    it++;
-            }
-        }
-        if (replyCollection.empty()) {
-            LOG(ERROR) << "Couldn't find "<< serviceName.c_str() << "." << serviceType.c_str() << "local." << " on InterfaceIndex: " << interfaceIndex << endl;
-            return false;
-        }
-
-        // Remove the repeated item of the same name
-        for (it = ++replyCollection.begin(); it != replyCollection.end();) {
-            for (it1 = replyCollection.begin(); it1 < it; it1++) {
-                if (it1->name == it->name) {
-                    break;
-                }
-            }
-            if (it1 != it)
-                it = replyCollection.erase(it);
-            else
-                it++;
-        }
-    }
+bool BrowseBonjour::browse(const string& serviceName, mDNSResult& result, int timeout)
+{
+    result.valid = false;
+    deque<mDNSResult> resultCollection;
+    BonjourPipeline pipeline("", serviceName, 0, [&resultCollection](const mDNSResult& res) { resultCollection.push_back(res); }, true);
+    pipeline.run(timeout);
 
-    // Resolve
-    deque<mDNSResolve_> resolveCollection;
-    {
-        DNSServiceHandle service(new DNSServiceRef(NULL));
-        for (auto& reply : replyCollection) {
-            LOG(NOTICE) << "Resoving : " << reply.name.c_str() << "." << reply.regtype.c_str() << reply.domain.c_str() << endl;
-            CHECKED(DNSServiceResolve(
-                service.get(), 0, interfaceIndex, reply.name.c_str(), reply.regtype.c_str(), reply.domain.c_str(),
-                [](DNSServiceRef /*service*/, DNSServiceFlags /*flags*/, uint32_t interfaceIndex, DNSServiceErrorType errorCode, const char* fullName,
-                   const char* hosttarget, uint16_t port, uint16_t txtLen, const unsigned char* txtRecord, void* context) {
-                    auto resultCollection = static_cast<deque<mDNSResolve_>*>(context);
+    if (resultCollection.empty())
+        return false;
 
-                    CHECKED(errorCode);
-                    vector<char> txt(txtRecord, txtRecord+txtLen);
-                    resultCollection->push_back(mDNSResolve_{interfaceIndex, string(fullName), string(hosttarget), ntohs(port), txtLen, txt});
-                    LOG(NOTICE) << "Resoved service: Fullname: <" << fullName << "> Host: <" << hosttarget << "> port: <" << ntohs(port) << "> interfaceIndex: <" << interfaceIndex << ">" << endl;
-                },
-                &resolveCollection));
+    result = resultCollection.front();
 
-            runServiceWithTimeout(service, 300);
-        }
-    }
+    return true;
+}
 
-    for (int i = 0; i < resolveCollection.size(); i++) {
-        LOG(NOTICE) << "resolve: <" << i+1 << ">"
-        << "\nifaceindex: " << resolveCollection[i].ifIndex
-        << "\nfullname  : " << resolveCollection[i].fullName.c_str()
-        << "\nhost      : " << resolveCollection[i].host
-        << "\nport      : " << resolveCollection[i].port
-        << "\ntxtLen    : " << resolveCollection[i].txtLen
-        << "\ntxtRecord : " << resolveCollection[i].txtRecord.data()
-        << endl;
-    }
+bool BrowseBonjour::browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, std::vector<mDNSResult>& results, int timeout)
+{
+    LOG(NOTICE, LOG_TAG) << " browse"<< endl;
 
-    // DNS/mDNS Resolve
-    deque<mDNSResult> resultCollection(resolveCollection.size(), mDNSResult{IPVersion::IPv4, 0, "", "", 0, false});
-    {
-        DNSServiceHandle service(new DNSServiceRef(NULL));
-        unsigned i = 0;
-        for (auto& resolve : resolveCollection)
-        {
-            resultCollection[i].port = resolve.port;
-            LOG(NOTICE) << "DNS/mDNS Resoving. interfaceIndex: " << resolve.ifIndex << " host: " << resolve.host.c_str() << " fullName: " << resolve.fullName << endl;
-            CHECKED(DNSServiceGetAddrInfo(
-                service.get(), kDNSServiceFlagsLongLivedQuery, resolve.ifIndex, kDNSServiceProtocol_IPv4, resolve.host.c_str(),
-                [](DNSServiceRef /*service*/, DNSServiceFlags /*flags*/, uint32_t interfaceIndex, DNSServiceErrorType errorCode, const char* hostname,
-                   const sockaddr* address, uint32_t /*ttl*/, void* context) {
-                    auto result = static_cast<mDNSResult*>(context);
-
-                    CHECKED(errorCode);
-                    result->host = string(hostname);
-                    result->ip_version = (address->sa_family == AF_INET) ? (IPVersion::IPv4) : (IPVersion::IPv6);
-                    result->iface_idx = static_cast<int>(interfaceIndex);
-
-                    char hostIP[NI_MAXHOST];
-                    char hostService[NI_MAXSERV];
-                    if (getnameinfo(address, sizeof(*address), hostIP, sizeof(hostIP), hostService, sizeof(hostService), NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
-                        result->ip = string(hostIP);
-                        LOG(NOTICE) << "DNS resolved: hostname: " << hostname << " IP: " << hostIP << " interfaceIndex: " << interfaceIndex << " serveice: " << hostService << endl;
-                    }
-                    else {
-                        LOG(ERROR) << "DNS resolve failed" << endl;
-                        return;
-                    }
-                    result->valid = true;
-                },
-                &resultCollection[i++]));
-
-            runServiceWithTimeout(service, 200);
-        }
-    }
+    uint32_t interfaceIndex;
+    if (!getInterfaceIndex(interfaceName, interfaceIndex))
+        return false;
 
-    resultCollection.erase(std::remove_if(resultCollection.begin(), resultCollection.end(), [](const mDNSResult& res) { return res.ip.empty(); }),
-                           resultCollection.end());
+    LOG(NOTICE, LOG_TAG) << "try to browse: <" << serviceName.c_str() << ">.<" << serviceType.c_str() << "><local.> interfaceName: <" << interfaceName.c_str() << "> interfaceIndex: <" << interfaceIndex << ">" << endl;
+    deque<mDNSResult> resultCollection;
+    BonjourPipeline pipeline(serviceName, serviceType, interfaceIndex, [&resultCollection](const mDNSResult& res) { resultCollection.push_back(res); });
+    pipeline.run(timeout);
 
     if (resultCollection.empty())
+    {
+        LOG(ERROR) << "Couldn't find " << serviceName.c_str() << "." << serviceType.c_str() << "local."
+                   << " on InterfaceIndex: " << interfaceIndex << endl;
         return false;
+    }
 
     //if (resultCollection.size() > 1)
     //    LOG(NOTICE, LOG_TAG) << "Multiple servers found.  Using first" << endl;
@@ -468,7 +728,7 @@ bool BrowseBonjour::browse(const std::string& serviceName, const std::string& se
 
     results.assign(resultCollection.begin(), resultCollection.end());
     LOG(NOTICE) << results.size() << " servers found." << endl;
-    for (int i = 0; i < results.size(); i++) {
+    for (size_t i = 0; i < results.size(); i++) {
         LOG(NOTICE) << "result: <" << i+1 << ">"
         << "\nip_version: " << results[i].ip_version
         << "\nip        : " << results[i].ip
@@ -481,20 +741,371 @@ bool BrowseBonjour::browse(const std::string& serviceName, const std::string& se
     return true;
 }
 
-bool BrowseBonjour::browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, mDNSResult& result, int /*timeout*/)
+bool BrowseBonjour::browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, mDNSResult& result, int timeout)
+{
+    result.valid = false;
+    uint32_t interfaceIndex;
+    if (!getInterfaceIndex(interfaceName, interfaceIndex))
+        return false;
+
+    LOG(NOTICE, LOG_TAG) << "try to browse first hit: <" << serviceName.c_str() << ">.<" << serviceType.c_str() << "><local.> interfaceName: <"
+                         << interfaceName.c_str() << "> interfaceIndex: <" << interfaceIndex << ">" << endl;
+    BonjourPipeline pipeline(serviceName, serviceType, interfaceIndex, [&result](const mDNSResult& res) {
+        if (!result.valid)
+            result = res;
+    }, true);
+    pipeline.run(timeout);
+
+    if (!result.valid)
+    {
+        LOG(ERROR) << "Couldn't find " << serviceName.c_str() << "." << serviceType.c_str() << "local."
+                   << " on InterfaceIndex: " << interfaceIndex << endl;
+        return false;
+    }
+
+    LOG(NOTICE) << "ip: " << result.ip.c_str() << endl;
+    return true;
+}
+
+
+void BrowseBonjour::asyncBrowse(boost::asio::io_context& io, const std::string& serviceName, const std::string& serviceType,
+                                const std::string& interfaceName, bool firstHit, int timeout, BrowseHandler handler)
 {
-    std::vector<mDNSResult> results;
-    if (browse(serviceName, serviceType, interfaceName, results, 0)) {
-        if (results.size() >= 1) {
-            if (results.size() > 1)
-                LOG(NOTICE, LOG_TAG) << "Multiple servers found.  Using first" << endl;
-            result = results.at(0);
-            LOG(NOTICE) << "ip: " << result.ip.c_str() << endl;
-            return true;
+    uint32_t interfaceIndex;
+    if (!getInterfaceIndex(interfaceName, interfaceIndex))
+    {
+        boost::asio::post(io, [handler] { handler(boost::asio::error::no_such_device, {}); });
+        return;
+    }
+
+    /// Keeps the pipeline and its reactor alive until the handler has been posted
+    struct Operation
+    {
+        explicit Operation(boost::asio::io_context& io) : reactor(io)
+        {
+        }
+
+        AsioReactor reactor;
+        std::unique_ptr<BonjourPipeline> pipeline;
+        std::vector<mDNSResult> results;
+    };
+
+    LOG(NOTICE, LOG_TAG) << "try to browse async: <" << serviceName << ">.<" << serviceType << "><local.> interfaceName: <" << interfaceName
+                         << "> interfaceIndex: <" << interfaceIndex << ">" << endl;
+    auto op = std::make_shared<Operation>(io);
+    boost::asio::dispatch(op->reactor.strand(), [&io, op, serviceName, serviceType, interfaceIndex, firstHit, timeout, handler] {
+        // raw pointer, the pipeline must not keep its owner alive
+        Operation* operation = op.get();
+        op->pipeline.reset(new BonjourPipeline(op->reactor, serviceName, serviceType, interfaceIndex,
+                                               [operation](const mDNSResult& result) { operation->results.push_back(result); }, firstHit));
+        try
+        {
+            op->pipeline->start(timeout, [&io, op, handler] {
+                boost::system::error_code ec;
+                if (op->results.empty())
+                    ec = boost::asio::error::host_not_found;
+                // the operation is released by the posted handler, not from within its own reactor
+                boost::asio::post(io, [op, handler, ec] { handler(ec, op->results); });
+            });
         }
+        catch (const std::exception& e)
+        {
+            LOG(ERROR, LOG_TAG) << "Browse failed: " << e.what() << endl;
+            op->pipeline.reset();
+            boost::asio::post(io, [handler] { handler(boost::asio::error::host_not_found, {}); });
+        }
+    });
+}
+
+/// Split a DNS-SD TXT record (length prefixed "key=value" strings) into its key/value pairs
+static std::map<std::string, std::string> parseTxtRecord(const unsigned char* txtRecord, uint16_t txtLen)
+{
+    std::map<std::string, std::string> txt;
+    size_t pos = 0;
+    while (pos < txtLen)
+    {
+        size_t len = txtRecord[pos++];
+        if (pos + len > txtLen)
+            break;
+        string item(reinterpret_cast<const char*>(txtRecord + pos), len);
+        pos += len;
+        if (item.empty())
+            continue;
+        auto eq = item.find('=');
+        if (eq == string::npos)
+            txt[item] = "";
+        else
+            txt[item.substr(0, eq)] = item.substr(eq + 1);
     }
+    return txt;
+}
 
-    return false;
+
+/// State of a running BonjourServiceWatcher, owned by its worker thread
+/// DNSServiceRefs are never released while their results are being processed: removals and
+/// address lookup restarts requested by callbacks are carried out in sweep()
+struct BonjourWatch
+{
+    struct Instance
+    {
+        BonjourWatch* watch;
+        mDNSService service;
+        /// interfaces the instance has been browsed on
+        std::set<uint32_t> interfaces;
+        DNSServiceHandle resolve;
+        DNSServiceHandle addrInfo;
+        string hostTarget;
+        uint32_t ifIndex;
+        bool lookupPending;
+        bool removed;
+    };
+
+    explicit BonjourWatch(BonjourServiceWatcher* watcher) : watcher(watcher), reactor(watcher->reactor_)
+    {
+    }
+
+    ~BonjourWatch()
+    {
+        for (auto& instance : instances)
+        {
+            release(instance.second->resolve);
+            release(instance.second->addrInfo);
+        }
+        release(browse);
+    }
+
+    /// Watch ref on the reactor, results are processed and errors logged
+    void watch(const DNSServiceHandle& ref)
+    {
+        DNSServiceRef raw = *ref;
+        reactor.add(DNSServiceRefSockFD(raw), [raw](uint32_t /*events*/) {
+            auto err = DNSServiceProcessResult(raw);
+            if (err != kDNSServiceErr_NoError)
+                LOG(ERROR, LOG_TAG) << "Failed to process result: " << BonjourGetError(err) << endl;
+        });
+    }
+
+    /// Stop watching ref and deallocate it
+    void release(DNSServiceHandle& ref)
+    {
+        if (!ref)
+            return;
+        if (*ref != nullptr)
+            reactor.remove(DNSServiceRefSockFD(*ref));
+        ref.reset();
+    }
+
+    static void browseReply(DNSServiceRef /*service*/, DNSServiceFlags flags, uint32_t interfaceIndex, DNSServiceErrorType errorCode,
+                            const char* replyName, const char* regtype, const char* replyDomain, void* context)
+    {
+        auto watch = static_cast<BonjourWatch*>(context);
+        if (errorCode != kDNSServiceErr_NoError)
+        {
+            LOG(ERROR, LOG_TAG) << "Watch browse failed: " << BonjourGetError(errorCode) << endl;
+            return;
+        }
+
+        auto& instance = watch->instances[replyName];
+        if ((flags & kDNSServiceFlagsAdd) == 0)
+        {
+            LOG(INFO, LOG_TAG) << "Watch: service removed: " << replyName << "." << regtype << replyDomain << " InterfaceIndex: " << interfaceIndex << endl;
+            if (instance)
+            {
+                instance->interfaces.erase(interfaceIndex);
+                instance->removed = instance->interfaces.empty();
+            }
+            else
+                watch->instances.erase(replyName);
+            return;
+        }
+
+        LOG(INFO, LOG_TAG) << "Watch: service added: " << replyName << "." << regtype << replyDomain << " InterfaceIndex: " << interfaceIndex << endl;
+        if (instance)
+        {
+            instance->interfaces.insert(interfaceIndex);
+            instance->removed = false;
+            return;
+        }
+
+        instance.reset(new Instance{watch, mDNSService{replyName, regtype, replyDomain, {}, mDNSResult{IPVersion::IPv4, 0, "", "", 0, false, 0, 0}},
+                                    {interfaceIndex}, nullptr, nullptr, "", interfaceIndex, false, false});
+        // The resolve stays open to receive TXT and port updates
+        instance->resolve.reset(new DNSServiceRef(NULL));
+        auto err = DNSServiceResolve(instance->resolve.get(), 0, interfaceIndex, replyName, regtype, replyDomain, resolveReply, instance.get());
+        if (err != kDNSServiceErr_NoError)
+        {
+            LOG(ERROR, LOG_TAG) << "Failed to resolve " << replyName << ": " << BonjourGetError(err) << endl;
+            instance->resolve.reset();
+            instance->removed = true;
+            return;
+        }
+        watch->watch(instance->resolve);
+    }
+
+    static void resolveReply(DNSServiceRef /*service*/, DNSServiceFlags /*flags*/, uint32_t interfaceIndex, DNSServiceErrorType errorCode,
+                             const char* /*fullName*/, const char* hosttarget, uint16_t port, uint16_t txtLen, const unsigned char* txtRecord,
+                             void* context)
+    {
+        auto instance = static_cast<Instance*>(context);
+        if (errorCode != kDNSServiceErr_NoError)
+        {
+            LOG(ERROR, LOG_TAG) << "Watch: resolve of " << instance->service.name << " failed: " << BonjourGetError(errorCode) << endl;
+            return;
+        }
+
+        instance->service.txt = parseTxtRecord(txtRecord, txtLen);
+        instance->service.result.port = ntohs(port);
+        if ((instance->hostTarget != hosttarget) || (instance->ifIndex != interfaceIndex) || !instance->addrInfo)
+        {
+            instance->hostTarget = hosttarget;
+            instance->ifIndex = interfaceIndex;
+            instance->lookupPending = true;
+        }
+        else
+            instance->watch->watcher->update(instance->service);
+    }
+
+    static void addrInfoReply(DNSServiceRef /*service*/, DNSServiceFlags flags, uint32_t interfaceIndex, DNSServiceErrorType errorCode,
+                              const char* hostname, const sockaddr* address, uint32_t ttl, void* context)
+    {
+        auto instance = static_cast<Instance*>(context);
+        if (errorCode != kDNSServiceErr_NoError)
+        {
+            LOG(ERROR, LOG_TAG) << "Watch: address lookup of " << instance->hostTarget << " failed: " << BonjourGetError(errorCode) << endl;
+            return;
+        }
+
+        char hostIP[NI_MAXHOST];
+        socklen_t addressLen = (address->sa_family == AF_INET6) ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+        if (getnameinfo(address, addressLen, hostIP, sizeof(hostIP), nullptr, 0, NI_NUMERICHOST) != 0)
+            return;
+
+        mDNSResult& result = instance->service.result;
+        if ((flags & kDNSServiceFlagsAdd) == 0)
+        {
+            // the address we report is gone
+            if (result.valid && (result.ip == hostIP))
+            {
+                result.valid = false;
+                instance->watch->watcher->remove(instance->service.name);
+            }
+            return;
+        }
+
+        if (!isUsableAddress(address))
+            return;
+        // a valid address is not replaced by one of the other family, that would report an update for every answer
+        IPVersion ipVersion = (address->sa_family == AF_INET) ? (IPVersion::IPv4) : (IPVersion::IPv6);
+        if (result.valid && (result.ip_version != ipVersion))
+            return;
+
+        result.host = string(hostname);
+        result.ip = string(hostIP);
+        result.ip_version = (address->sa_family == AF_INET) ? (IPVersion::IPv4) : (IPVersion::IPv6);
+        result.iface_idx = static_cast<int>(interfaceIndex);
+        result.ttl = ttl;
+        result.valid = true;
+        instance->watch->watcher->update(instance->service);
+    }
+
+    /// Carry out the removals and lookups requested by the callbacks
+    void sweep()
+    {
+        for (auto it = instances.begin(); it != instances.end();)
+        {
+            Instance& instance = *it->second;
+            if (instance.removed)
+            {
+                watcher->remove(instance.service.name);
+                release(instance.resolve);
+                release(instance.addrInfo);
+                it = instances.erase(it);
+                continue;
+            }
+
+            if (instance.lookupPending)
+            {
+                instance.lookupPending = false;
+                release(instance.addrInfo);
+                instance.addrInfo.reset(new DNSServiceRef(NULL));
+                auto err = DNSServiceGetAddrInfo(instance.addrInfo.get(), kDNSServiceFlagsLongLivedQuery, instance.ifIndex,
+                                                 kDNSServiceProtocol_IPv4 | kDNSServiceProtocol_IPv6, instance.hostTarget.c_str(), addrInfoReply, &instance);
+                if (err != kDNSServiceErr_NoError)
+                {
+                    LOG(ERROR, LOG_TAG) << "Failed to look up " << instance.hostTarget << ": " << BonjourGetError(err) << endl;
+                    instance.addrInfo.reset();
+                }
+                else
+                    watch(instance.addrInfo);
+            }
+            ++it;
+        }
+    }
+
+    BonjourServiceWatcher* watcher;
+    EpollReactor& reactor;
+    DNSServiceHandle browse;
+    std::map<string, std::unique_ptr<Instance>> instances;
+};
+
+
+BonjourServiceWatcher::BonjourServiceWatcher(const std::string& serviceType, const std::string& interfaceName)
+    : ServiceWatcher(serviceType, interfaceName), active_(false)
+{
+}
+
+
+BonjourServiceWatcher::~BonjourServiceWatcher()
+{
+    stop();
+}
+
+
+void BonjourServiceWatcher::start()
+{
+    if (thread_.joinable())
+        return;
+    active_ = true;
+    thread_ = std::thread(&BonjourServiceWatcher::worker, this);
+}
+
+
+void BonjourServiceWatcher::stop()
+{
+    if (!thread_.joinable())
+        return;
+    active_ = false;
+    reactor_.wakeup();
+    thread_.join();
+}
+
+
+void BonjourServiceWatcher::worker()
+{
+    BonjourWatch watch(this);
+    try
+    {
+        uint32_t interfaceIndex;
+        if (!getInterfaceIndex(interfaceName_, interfaceIndex))
+            return;
+
+        LOG(NOTICE, LOG_TAG) << "Watching <" << serviceType_ << "><local.> interfaceIndex: <" << interfaceIndex << ">" << endl;
+        watch.browse.reset(new DNSServiceRef(NULL));
+        CHECKED(DNSServiceBrowse(watch.browse.get(), 0, interfaceIndex, serviceType_.c_str(), "local.", BonjourWatch::browseReply, &watch));
+
+        watch.watch(watch.browse);
+
+        while (active_)
+        {
+            if (!reactor_.runOnce())
+                continue;
+            watch.sweep();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        LOG(ERROR, LOG_TAG) << "Watching " << serviceType_ << " failed: " << e.what() << endl;
+    }
 }
 
 #undef CHECKED
@@ -2,8 +2,13 @@
 #define BROWSEBONJOUR_H
 
 #include <dns_sd.h>
+#include <atomic>
+#include <thread>
+
+#include "common/reactor.hpp"
 
 class BrowseBonjour;
+class BonjourServiceWatcher;
 
 #include "browse_mdns.hpp"
 
@@ -13,5 +18,27 @@ public:
     bool browse(const std::string& serviceName, mDNSResult& result, int timeout) override;
     bool browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, mDNSResult& result, int timeout) override;
     bool browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, std::vector<mDNSResult>& results, int timeout) override;
+    /// The DNS-SD sockets are watched by the io_context, no extra thread is involved
+    void asyncBrowse(boost::asio::io_context& io, const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName,
+                     bool firstHit, int timeout, BrowseHandler handler) override;
+};
+
+class BonjourServiceWatcher : public ServiceWatcher
+{
+public:
+    BonjourServiceWatcher(const std::string& serviceType, const std::string& interfaceName);
+    ~BonjourServiceWatcher() override;
+
+    void start() override;
+    void stop() override;
+
+private:
+    friend struct BonjourWatch;
+    void worker();
+
+    std::thread thread_;
+    std::atomic<bool> active_;
+    /// only used by the worker thread, stop() wakes it up
+    EpollReactor reactor_;
 };
 #endif
@@ -0,0 +1,295 @@
+#include "browse_mdns.hpp"
+
+#include <ifaddrs.h>
+#include <net/if.h>
+
+#include <algorithm>
+#include <boost/asio.hpp>
+
+#include "common/aixlog.hpp"
+#include "common/snap_exception.hpp"
+
+static constexpr auto LOG_TAG = "mDNS";
+
+/// Time the other interfaces get to answer after the first answer, before the results are reported
+static constexpr auto INTERFACE_SETTLE = std::chrono::milliseconds(50);
+
+
+/// @return true if a subscriber would notice a difference between a and b
+static bool changed(const mDNSService& a, const mDNSService& b)
+{
+    return (a.txt != b.txt) || (a.result.ip != b.result.ip) || (a.result.port != b.result.port) || (a.result.host != b.result.host) ||
+           (a.result.iface_idx != b.result.iface_idx);
+}
+
+
+mDNSEngine mDNSEngineFromString(const std::string& name)
+{
+    if (name == "bonjour")
+        return mDNSEngine::Bonjour;
+    if (name == "avahi")
+        return mDNSEngine::Avahi;
+    if (name == "auto")
+        return mDNSEngine::Auto;
+    throw SnapException("Unknown mDNS engine: " + name);
+}
+
+
+/// @return the engine that Auto stands for
+static mDNSEngine resolveEngine(mDNSEngine engine)
+{
+    if (engine != mDNSEngine::Auto)
+        return engine;
+#if defined(HAS_BONJOUR)
+    return mDNSEngine::Bonjour;
+#elif defined(HAS_AVAHI)
+    return mDNSEngine::Avahi;
+#else
+    throw SnapException("No mDNS engine available");
+#endif
+}
+
+
+std::unique_ptr<BrowsemDNS> BrowsemDNS::create(mDNSEngine engine)
+{
+    switch (resolveEngine(engine))
+    {
+#if defined(HAS_BONJOUR)
+        case mDNSEngine::Bonjour:
+            return std::unique_ptr<BrowsemDNS>(new BrowseBonjour());
+#endif
+#if defined(HAS_AVAHI)
+        case mDNSEngine::Avahi:
+            return std::unique_ptr<BrowsemDNS>(new BrowseAvahi());
+#endif
+        default:
+            throw SnapException("mDNS engine not available");
+    }
+}
+
+
+std::vector<std::string> upInterfaces()
+{
+    std::vector<std::string> names;
+    ifaddrs* addrs;
+    if (getifaddrs(&addrs) != 0)
+        return names;
+    for (ifaddrs* ifa = addrs; ifa != nullptr; ifa = ifa->ifa_next)
+    {
+        unsigned int flags = ifa->ifa_flags;
+        if (((flags & IFF_UP) == 0) || ((flags & IFF_RUNNING) == 0) || ((flags & IFF_LOOPBACK) != 0) || ((flags & IFF_MULTICAST) == 0))
+            continue;
+        // getifaddrs lists an interface once per address family
+        if (std::find(names.begin(), names.end(), ifa->ifa_name) == names.end())
+            names.emplace_back(ifa->ifa_name);
+    }
+    freeifaddrs(addrs);
+    return names;
+}
+
+
+void BrowsemDNS::asyncBrowseInterfaces(boost::asio::io_context& io, const std::string& serviceName, const std::string& serviceType,
+                                       const std::vector<std::string>& interfaceNames, int timeout, BrowseHandler handler)
+{
+    /// Collects the answers of all interfaces, serialized on its strand
+    struct Race
+    {
+        explicit Race(boost::asio::io_context& io, BrowseHandler handler) : strand(boost::asio::make_strand(io)), settle(io), handler(std::move(handler))
+        {
+        }
+
+        void finish()
+        {
+            if (done)
+                return;
+            done = true;
+            settle.cancel();
+            std::stable_sort(results.begin(), results.end(), [](const mDNSResult& a, const mDNSResult& b) { return a.rtt < b.rtt; });
+            boost::system::error_code ec;
+            if (results.empty())
+                ec = boost::asio::error::host_not_found;
+            handler(ec, results);
+        }
+
+        boost::asio::strand<boost::asio::io_context::executor_type> strand;
+        boost::asio::steady_timer settle;
+        BrowseHandler handler;
+        size_t pending = 0;
+        bool done = false;
+        std::vector<mDNSResult> results;
+    };
+
+    std::vector<std::string> names = interfaceNames.empty() ? upInterfaces() : interfaceNames;
+    if (names.empty())
+    {
+        boost::asio::post(io, [handler] { handler(boost::asio::error::no_such_device, {}); });
+        return;
+    }
+
+    auto race = std::make_shared<Race>(io, std::move(handler));
+    race->pending = names.size();
+    for (const auto& name : names)
+    {
+        LOG(INFO, LOG_TAG) << "Browsing on " << name << "\n";
+        asyncBrowse(io, serviceName, serviceType, name, true, timeout, [race, name](const boost::system::error_code& ec, const std::vector<mDNSResult>& results) {
+            boost::asio::post(race->strand, [race, name, ec, results] {
+                --race->pending;
+                if (race->done)
+                    return;
+                if (!ec)
+                {
+                    for (const auto& result : results)
+                        LOG(INFO, LOG_TAG) << "Found " << result.ip << " on " << name << ", rtt: " << result.rtt << " us\n";
+                    race->results.insert(race->results.end(), results.begin(), results.end());
+                }
+                if (race->pending == 0)
+                {
+                    race->finish();
+                    return;
+                }
+                // the first answer starts the settle time for the others
+                if (!ec && (race->results.size() == results.size()))
+                {
+                    race->settle.expires_after(INTERFACE_SETTLE);
+                    race->settle.async_wait(boost::asio::bind_executor(race->strand, [race](const boost::system::error_code& ec) {
+                        if (!ec)
+                            race->finish();
+                    }));
+                }
+            });
+        });
+    }
+}
+
+
+ServiceWatcher::ServiceWatcher(const std::string& serviceType, const std::string& interfaceName)
+    : serviceType_(serviceType), interfaceName_(interfaceName), nextId_(0)
+{
+}
+
+
+std::shared_ptr<ServiceWatcher> ServiceWatcher::create(const std::string& serviceType, const std::string& interfaceName, mDNSEngine engine)
+{
+    switch (resolveEngine(engine))
+    {
+#if defined(HAS_BONJOUR)
+        case mDNSEngine::Bonjour:
+            return std::make_shared<BonjourServiceWatcher>(serviceType, interfaceName);
+#endif
+#if defined(HAS_AVAHI)
+        case mDNSEngine::Avahi:
+            return std::make_shared<AvahiServiceWatcher>(serviceType, interfaceName);
+#endif
+        default:
+            throw SnapException("mDNS engine not available");
+    }
+}
+
+
+std::shared_ptr<ServiceWatcher> ServiceWatcher::shared(const std::string& serviceType, const std::string& interfaceName, mDNSEngine engine)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<ServiceWatcher>> watchers;
+
+    engine = resolveEngine(engine);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& weak = watchers[std::to_string(static_cast<int>(engine)) + ":" + serviceType + "%" + interfaceName];
+    auto watcher = weak.lock();
+    if (!watcher)
+    {
+        watcher = create(serviceType, interfaceName, engine);
+        watcher->start();
+        weak = watcher;
+    }
+    return watcher;
+}
+
+
+size_t ServiceWatcher::subscribe(const Handler& handler)
+{
+    // a service that is removed meanwhile is reported as Removed after it has been replayed as Added
+    std::lock_guard<std::recursive_mutex> notifyLock(notifyMutex_);
+    std::vector<mDNSService> known;
+    size_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        id = nextId_++;
+        handlers_[id] = handler;
+        for (const auto& service : services_)
+            known.push_back(service.second);
+    }
+
+    for (const auto& service : known)
+        handler(ServiceEvent::Added, service);
+    return id;
+}
+
+
+void ServiceWatcher::unsubscribe(size_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    handlers_.erase(id);
+}
+
+
+std::vector<mDNSService> ServiceWatcher::services() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<mDNSService> result;
+    for (const auto& service : services_)
+        result.push_back(service.second);
+    return result;
+}
+
+
+void ServiceWatcher::update(const mDNSService& service)
+{
+    if (!service.result.valid)
+        return;
+
+    std::lock_guard<std::recursive_mutex> notifyLock(notifyMutex_);
+    ServiceEvent event;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = services_.find(service.name);
+        if (it == services_.end())
+            event = ServiceEvent::Added;
+        else if (changed(it->second, service))
+            event = ServiceEvent::Updated;
+        else
+            return;
+        services_[service.name] = service;
+    }
+    notify(event, service);
+}
+
+
+void ServiceWatcher::remove(const std::string& name)
+{
+    std::lock_guard<std::recursive_mutex> notifyLock(notifyMutex_);
+    mDNSService service;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = services_.find(name);
+        if (it == services_.end())
+            return;
+        service = it->second;
+        services_.erase(it);
+    }
+    notify(ServiceEvent::Removed, service);
+}
+
+
+void ServiceWatcher::notify(ServiceEvent event, const mDNSService& service)
+{
+    // handlers are called without holding the lock, so that they can (un)subscribe
+    std::vector<Handler> handlers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& handler : handlers_)
+            handlers.push_back(handler.second);
+    }
+
+    for (const auto& handler : handlers)
+        handler(event, service);
+}
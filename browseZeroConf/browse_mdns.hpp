@@ -1,6 +1,12 @@
 #ifndef BROWSEMDNS_H
 #define BROWSEMDNS_H
 
+#include <boost/asio/io_context.hpp>
+#include <boost/system/error_code.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -19,19 +25,139 @@ struct mDNSResult
     std::string host;
     uint16_t port;
     bool valid;
+    /// TTL of the address record in seconds, 0 if unknown
+    uint32_t ttl;
+    /// round trip of the resolve and address lookup in µs, 0 if unknown
+    uint32_t rtt;
 };
 
+/// Discovery backend, Auto picks the first one that is compiled in
+enum class mDNSEngine
+{
+    Auto,
+    Bonjour,
+    Avahi
+};
+
+/// @return the engine named "bonjour", "avahi" or "auto"
+mDNSEngine mDNSEngineFromString(const std::string& name);
+
+
 class BrowsemDNS
 {
 public:
+    /// ec is host_not_found if nothing usable has been found
+    using BrowseHandler = std::function<void(const boost::system::error_code& ec, const std::vector<mDNSResult>& results)>;
+
+    virtual ~BrowsemDNS() = default;
+
+    /// @return a browser for engine, throws SnapException if the engine is not compiled in
+    static std::unique_ptr<BrowsemDNS> create(mDNSEngine engine = mDNSEngine::Auto);
+
+    /// The single result overloads run in first-hit mode: every outstanding DNS-SD operation
+    /// is stopped as soon as one resolved, usable IPv4/IPv6 address is known
     virtual bool browse(const std::string& serviceName, mDNSResult& result, int timeout) = 0;
     virtual bool browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, mDNSResult& result, int timeout) = 0;
+    /// Collects the results of all services that answer within the browse window
     virtual bool browse(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName, std::vector<mDNSResult>& results, int timeout) = 0;
+
+    /// Browse without blocking the caller, handler is posted to io once the browse is finished
+    /// @param firstHit stop after the first usable address like the single result overloads
+    /// @param timeout overall limit in ms, <= 0 for the engine's default
+    virtual void asyncBrowse(boost::asio::io_context& io, const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName,
+                             bool firstHit, int timeout, BrowseHandler handler) = 0;
+
+    /// Browse on several interfaces at once, one first-hit browse per interface, so no interface waits for another
+    /// handler gets the answers of every interface that replied until shortly after the first answer, lowest rtt first.
+    /// The results are tagged with the interface (iface_idx) they were found on.
+    /// @param interfaceNames interfaces to browse on, empty for every interface that is up
+    void asyncBrowseInterfaces(boost::asio::io_context& io, const std::string& serviceName, const std::string& serviceType,
+                               const std::vector<std::string>& interfaceNames, int timeout, BrowseHandler handler);
+};
+
+/// @return the names of all interfaces that are up, running and multicast capable, except loopback
+std::vector<std::string> upInterfaces();
+
+
+enum class ServiceEvent
+{
+    Added,
+    Updated,
+    Removed
+};
+
+
+/// A service instance as reported by a ServiceWatcher
+struct mDNSService
+{
+    std::string name;
+    std::string type;
+    std::string domain;
+    std::map<std::string, std::string> txt;
+    mDNSResult result;
+};
+
+
+/// Long-lived browse for one service type that reports services as they come, change and go
+/// The browse, resolves and address lookups stay open, so changes are pushed instead of polled.
+class ServiceWatcher
+{
+public:
+    using Handler = std::function<void(ServiceEvent event, const mDNSService& service)>;
+
+    /// c'tor
+    /// @param serviceType the service type to watch, e.g. "_controller._tcp."
+    /// @param interfaceName interface to browse on, empty for all
+    ServiceWatcher(const std::string& serviceType, const std::string& interfaceName);
+    virtual ~ServiceWatcher() = default;
+
+    /// @return a watcher for engine, throws SnapException if the engine is not compiled in
+    static std::shared_ptr<ServiceWatcher> create(const std::string& serviceType, const std::string& interfaceName, mDNSEngine engine = mDNSEngine::Auto);
+
+    /// @return the started watcher for serviceType on interfaceName
+    /// All callers share one browse as long as any of them holds the returned pointer
+    static std::shared_ptr<ServiceWatcher> shared(const std::string& serviceType, const std::string& interfaceName, mDNSEngine engine = mDNSEngine::Auto);
+
+    /// Subscribe to service events, the currently known services are reported as Added right away
+    /// Handlers are called on the watcher's thread
+    /// @return id to unsubscribe with
+    size_t subscribe(const Handler& handler);
+    void unsubscribe(size_t id);
+
+    /// @return the currently known and resolved services
+    std::vector<mDNSService> services() const;
+
+    virtual void start() = 0;
+    virtual void stop() = 0;
+
+protected:
+    /// Report a resolved service, Added or Updated is derived from the known services
+    void update(const mDNSService& service);
+    /// Report that a service is gone
+    void remove(const std::string& name);
+
+    std::string serviceType_;
+    std::string interfaceName_;
+
+private:
+    void notify(ServiceEvent event, const mDNSService& service);
+
+    mutable std::mutex mutex_;
+    /// held from a change of services_ until its handlers have been called, and while a new subscriber gets
+    /// the known services, so every subscriber sees the events in order. Recursive for handlers that subscribe.
+    std::recursive_mutex notifyMutex_;
+    std::map<std::string, mDNSService> services_;
+    std::map<size_t, Handler> handlers_;
+    size_t nextId_;
 };
 
 
+#if defined(HAS_AVAHI)
+#include "browse_avahi.hpp"
+#endif
+#if defined(HAS_BONJOUR)
 #include "browse_bonjour.hpp"
-using BrowseZeroConf = BrowseBonjour;
+#endif
 
 
 #endif
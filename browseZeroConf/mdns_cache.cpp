@@ -0,0 +1,132 @@
+#include "mdns_cache.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+#include "common/aixlog.hpp"
+#include "common/json.hpp"
+#include "common/utils/file_utils.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+static constexpr auto LOG_TAG = "mDNSCache";
+
+
+mDNSCache::mDNSCache(const std::string& filename) : filename_(filename)
+{
+}
+
+
+std::string mDNSCache::key(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName)
+{
+    return serviceName + "." + serviceType + "local.%" + interfaceName;
+}
+
+
+bool mDNSCache::get(const std::string& key, mDNSResult& result) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if ((it == entries_.end()) || (it->second.expires <= Clock::now()))
+        return false;
+    result = it->second.result;
+    return true;
+}
+
+
+void mDNSCache::put(const std::string& key, const mDNSResult& result)
+{
+    if (!result.valid)
+        return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto ttl = (result.ttl != 0) ? result.ttl : DEFAULT_TTL;
+    entries_[key] = Entry{result, Clock::now() + chrono::seconds(ttl)};
+}
+
+
+void mDNSCache::erase(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.erase(key);
+}
+
+
+void mDNSCache::load()
+{
+    if (filename_.empty() || !utils::file::exists(filename_))
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    try
+    {
+        ifstream ifs(filename_);
+        json j;
+        ifs >> j;
+        auto now = Clock::now();
+        for (auto it = j.begin(); it != j.end(); ++it)
+        {
+            const json& e = it.value();
+            Clock::time_point expires(chrono::seconds(e.at("expires").get<int64_t>()));
+            if (expires <= now)
+                continue;
+            mDNSResult result{static_cast<IPVersion>(e.at("ip_version").get<int>()),
+                              e.at("iface_idx").get<int>(),
+                              e.at("ip").get<string>(),
+                              e.at("host").get<string>(),
+                              e.at("port").get<uint16_t>(),
+                              true,
+                              e.at("ttl").get<uint32_t>(),
+                              0};
+            entries_[it.key()] = Entry{result, expires};
+        }
+        LOG(INFO, LOG_TAG) << "Loaded " << entries_.size() << " entries from " << filename_ << endl;
+    }
+    catch (const std::exception& e)
+    {
+        LOG(ERROR, LOG_TAG) << "Failed to load " << filename_ << ": " << e.what() << endl;
+        entries_.clear();
+    }
+}
+
+
+void mDNSCache::save() const
+{
+    if (filename_.empty())
+        return;
+
+    // the lock is held while writing, so that concurrent saves don't share the temp file
+    std::lock_guard<std::mutex> lock(mutex_);
+    json j = json::object();
+    auto now = Clock::now();
+    for (const auto& entry : entries_)
+    {
+        if (entry.second.expires <= now)
+            continue;
+        const mDNSResult& result = entry.second.result;
+        j[entry.first] = {{"ip_version", static_cast<int>(result.ip_version)},
+                          {"iface_idx", result.iface_idx},
+                          {"ip", result.ip},
+                          {"host", result.host},
+                          {"port", result.port},
+                          {"ttl", result.ttl},
+                          {"expires", chrono::duration_cast<chrono::seconds>(entry.second.expires.time_since_epoch()).count()}};
+    }
+
+    // write to a temp file and rename it, so that a crash never leaves a truncated cache behind
+    auto pos = filename_.rfind('/');
+    if ((pos != string::npos) && (pos > 0))
+        utils::file::mkdirRecursive(filename_.substr(0, pos).c_str(), 0755);
+    string tmp = filename_ + ".tmp";
+    {
+        ofstream ofs(tmp, ofstream::out | ofstream::trunc);
+        ofs << j.dump();
+        if (!ofs.good())
+        {
+            LOG(ERROR, LOG_TAG) << "Failed to write " << tmp << endl;
+            return;
+        }
+    }
+    if (rename(tmp.c_str(), filename_.c_str()) != 0)
+        LOG(ERROR, LOG_TAG) << "Failed to rename " << tmp << " to " << filename_ << endl;
+}
@@ -0,0 +1,52 @@
+#ifndef MDNS_CACHE_HPP
+#define MDNS_CACHE_HPP
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "browse_mdns.hpp"
+
+/// In-memory and on-disk cache of resolved mDNS results
+/// Entries are keyed by service name, type and interface and expire with the record TTL,
+/// so that a restarted client can connect to the last known endpoint without browsing first
+class mDNSCache
+{
+public:
+    /// Lifetime in seconds of results that don't carry a TTL (mDNS host record default)
+    static constexpr uint32_t DEFAULT_TTL = 120;
+
+    /// c'tor
+    /// @param filename file to persist the cache to, empty for an in-memory only cache
+    explicit mDNSCache(const std::string& filename);
+
+    /// @return the cache key for a service name, type and interface
+    static std::string key(const std::string& serviceName, const std::string& serviceType, const std::string& interfaceName);
+
+    /// @return true and the cached result if an unexpired entry exists for key
+    bool get(const std::string& key, mDNSResult& result) const;
+    /// Store or replace the result for key, it expires after result.ttl seconds
+    void put(const std::string& key, const mDNSResult& result);
+    void erase(const std::string& key);
+
+    /// Read the cache file, expired entries are dropped
+    void load();
+    /// Write all unexpired entries to the cache file
+    void save() const;
+
+private:
+    using Clock = std::chrono::system_clock;
+
+    struct Entry
+    {
+        mDNSResult result;
+        Clock::time_point expires;
+    };
+
+    std::string filename_;
+    std::map<std::string, Entry> entries_;
+    mutable std::mutex mutex_;
+};
+
+#endif
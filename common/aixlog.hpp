@@ -32,9 +32,12 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <functional>
@@ -93,13 +96,28 @@
 #define AIXLOG_INTERNAL__LOG_MACRO_CHOOSER(...) AIXLOG_INTERNAL__VAR_PARM(__VA_ARGS__, AIXLOG_INTERNAL__LOG_SEVERITY_TAG, AIXLOG_INTERNAL__LOG_SEVERITY, )
 #define AIXLOG_INTERNAL__COLOR_MACRO_CHOOSER(...) AIXLOG_INTERNAL__VAR_PARM(__VA_ARGS__, AIXLOG_INTERNAL__TWO_COLOR, AIXLOG_INTERNAL__ONE_COLOR, )
 
+/// Log statements below this severity (0 = TRACE ... 6 = FATAL) are compiled out
+#ifndef AIXLOG_MIN_SEVERITY
+#define AIXLOG_MIN_SEVERITY 0
+#endif
+
+#define AIXLOG_INTERNAL__FIRST_(FIRST_, ...) FIRST_
+#define AIXLOG_INTERNAL__FIRST(...) AIXLOG_INTERNAL__FIRST_(__VA_ARGS__, )
+/// The severity is checked before the statement, so the arguments of a filtered statement are not evaluated
+#define AIXLOG_INTERNAL__ENABLED(SEVERITY_)                                                                                                                    \
+    ((static_cast<int>(SEVERITY_) >= AIXLOG_MIN_SEVERITY) && AixLog::Log::enabled(static_cast<AixLog::Severity>(SEVERITY_)))
+
 /// External logger macros
 // usage: LOG(SEVERITY) or LOG(SEVERITY, TAG)
 // e.g.: LOG(NOTICE) or LOG(NOTICE, "my tag")
 #ifndef WIN32
 //#define LOG(...) AIXLOG_INTERNAL__LOG_MACRO_CHOOSER(__VA_ARGS__)(__VA_ARGS__) << TIMESTAMP << FUNC
 //for adk sys
-#define LOG(...) AIXLOG_INTERNAL__LOG_MACRO_CHOOSER(__VA_ARGS__)(__VA_ARGS__) << " - ["  << FUNC << "]" << " "
+// an expression instead of if/else, so that it can't steal the else of an unbraced if around it
+#define LOG(...)                                                                                                                                               \
+    !AIXLOG_INTERNAL__ENABLED(AIXLOG_INTERNAL__FIRST(__VA_ARGS__))                                                                                             \
+        ? (void)0                                                                                                                                              \
+        : AixLog::Voidify() & AIXLOG_INTERNAL__LOG_MACRO_CHOOSER(__VA_ARGS__)(__VA_ARGS__) << " - [" << FUNC << "]" << " "
 # endif
 
 // usage: COLOR(TEXT_COLOR, BACKGROUND_COLOR) or COLOR(TEXT_COLOR)
@@ -233,6 +251,17 @@ static std::string to_string(Severity logSeverity)
     }
 }
 
+/**
+ * @brief
+ * Turns the stream of a LOG statement into void, binds weaker than << and stronger than ?:
+ */
+struct Voidify
+{
+    void operator&(std::ostream& /*stream*/)
+    {
+    }
+};
+
 /**
  * @brief
  * Color constants used for console colors
@@ -398,6 +427,10 @@ struct Tag
     }
 
     virtual ~Tag() = default;
+    Tag(const Tag&) = default;
+    Tag(Tag&&) = default;
+    Tag& operator=(const Tag&) = default;
+    Tag& operator=(Tag&&) = default;
 
     explicit operator bool() const
     {
@@ -438,6 +471,10 @@ struct Function
     }
 
     virtual ~Function() = default;
+    Function(const Function&) = default;
+    Function(Function&&) = default;
+    Function& operator=(const Function&) = default;
+    Function& operator=(Function&&) = default;
 
     explicit operator bool() const
     {
@@ -516,6 +553,17 @@ public:
             add_filter(to_severity(filter));
     }
 
+    /// @return the lowest severity that matches for any tag
+    Severity min_severity() const
+    {
+        if (tag_filter_.empty())
+            return Severity::trace;
+        Severity result = Severity::fatal;
+        for (const auto& filter : tag_filter_)
+            result = std::min(result, filter.second);
+        return result;
+    }
+
 private:
     std::map<Tag, Severity> tag_filter_;
 };
@@ -551,6 +599,88 @@ static std::ostream& operator<<(std::ostream& os, const TextColor& text_color);
 
 using log_sink_ptr = std::shared_ptr<Sink>;
 
+/**
+ * @brief
+ * A complete log line with its meta data, as passed from a logging thread to the sinks
+ */
+struct Record
+{
+    Metadata metadata;
+    std::string message;
+};
+
+/**
+ * @brief
+ * Lock-free single producer, single consumer queue of log records
+ *
+ * The logging thread pushes, the drain thread pops. A full queue rejects the record instead of blocking the logging thread.
+ */
+class RecordQueue
+{
+public:
+    /// @param capacity rounded up to a power of two
+    explicit RecordQueue(size_t capacity) : head_(0), tail_(0), orphaned(false)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    /// Producer side
+    /// @return false if the queue is full
+    bool push(Record&& record)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_)
+            return false;
+        slots_[tail & mask_] = std::move(record);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer side
+    /// @return false if the queue is empty
+    bool pop(Record& record)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+        record = std::move(slots_[head & mask_]);
+        slots_[head & mask_].message.clear();
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    /// Producer side
+    size_t size() const
+    {
+        return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+private:
+    std::vector<Record> slots_;
+    size_t mask_;
+    /// on separate cache lines, so producer and consumer don't invalidate each other's index
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+
+public:
+    /// set when the producing thread has exited, the queue is freed once it is drained
+    std::atomic<bool> orphaned;
+};
+
 /**
  * @brief
  * Main Logger class with "Log::init"
@@ -569,14 +699,56 @@ public:
     }
 
     /// Without "init" every LOG(X) will simply go to clog
+    /// The sinks are called synchronously by the logging thread, an async logger is stopped
     static void init(const std::vector<log_sink_ptr> log_sinks = {})
     {
-        Log::instance().log_sinks_.clear();
+        Log::instance().stop_async();
+        {
+            std::lock_guard<std::recursive_mutex> lock(Log::instance().mutex_);
+            Log::instance().log_sinks_.clear();
+            Log::instance().update_threshold();
+        }
 
         for (const auto& sink : log_sinks)
             Log::instance().add_logsink(sink);
     }
 
+    /// @return false if no sink accepts severity, checked by LOG before anything is formatted
+    /// Lock-free, nothing is enabled until a sink is added, the lines would be discarded anyway
+    static bool enabled(Severity severity)
+    {
+        return static_cast<int>(severity) >= threshold().load(std::memory_order_relaxed);
+    }
+
+    /// Call after changing the filter of a sink that has been added, the filters are read when sinks are added
+    void update_threshold()
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        // nothing passes without sinks
+        int lowest = static_cast<int>(Severity::fatal) + 1;
+        for (const auto& sink : log_sinks_)
+            lowest = std::min(lowest, static_cast<int>(sink->filter.min_severity()));
+        threshold() = lowest;
+    }
+
+    /// Like "init", but the sinks are called by a drain thread
+    /// Every logging thread writes complete lines into its own lock-free queue of queue_size records, without taking a lock.
+    /// The drain thread moves them to the sinks in batches every drain_interval, records are dropped while a queue is full.
+    /// Must be called before other threads log.
+    static void init_async(const std::vector<log_sink_ptr> log_sinks, size_t queue_size = 1024,
+                           const std::chrono::milliseconds& drain_interval = std::chrono::milliseconds(10))
+    {
+        init(log_sinks);
+        Log::instance().start_async(queue_size, drain_interval);
+    }
+
+    /// Pass all queued records to the sinks, blocks until they are logged
+    void flush()
+    {
+        if (async_)
+            drain();
+    }
+
     template <typename T, typename... Ts>
     static std::shared_ptr<T> init(Ts&&... params)
     {
@@ -592,6 +764,7 @@ public:
         static_assert(std::is_base_of<Sink, typename std::decay<T>::type>::value, "type T must be a Sink");
         std::shared_ptr<T> sink = std::make_shared<T>(std::forward<Ts>(params)...);
         log_sinks_.push_back(sink);
+        update_threshold();
         return sink;
     }
 
@@ -599,61 +772,64 @@ public:
     {
         std::lock_guard<std::recursive_mutex> lock(mutex_);
         log_sinks_.push_back(sink);
+        update_threshold();
     }
 
     void remove_logsink(const log_sink_ptr& sink)
     {
         std::lock_guard<std::recursive_mutex> lock(mutex_);
         log_sinks_.erase(std::remove(log_sinks_.begin(), log_sinks_.end(), sink), log_sinks_.end());
+        update_threshold();
     }
 
 protected:
-    Log() noexcept : last_buffer_(nullptr), do_log_(true)
+    Log() noexcept : async_(false), queue_size_(1024), dropped_(0), draining_(false)
     {
         std::clog.rdbuf(this);
         std::clog << Severity() << Tag() << Function() << Conditional() << AixLog::Color::NONE << std::flush;
     }
 
+    /// A line that hasn't been terminated is lost, the thread_local state of the main thread is gone already
     virtual ~Log()
     {
-        sync();
+        stop_async();
     }
 
     int sync() override
     {
-        std::lock_guard<std::recursive_mutex> lock(mutex_);
-        if (!get_stream().str().empty())
-        {
-            if (do_log_)
-            {
-                for (const auto& sink : log_sinks_)
-                {
-                    if (sink->filter.match(metadata_))
-                        sink->log(metadata_, get_stream().str());
-                }
-            }
-            get_stream().str("");
-            get_stream().clear();
-        }
-
+        commit(thread_state());
         return 0;
     }
 
     int overflow(int c) override
     {
-        std::lock_guard<std::recursive_mutex> lock(mutex_);
-        if (c != EOF)
-        {
-            if (c == '\n')
-                sync();
-            else if (do_log_)
-                get_stream() << static_cast<char>(c);
-        }
-        else
+        ThreadState& state = thread_state();
+        if ((c == EOF) || (c == '\n'))
+            commit(state);
+        else if (state.do_log)
+            append(state, static_cast<char>(c));
+        return c;
+    }
+
+    /// Strings are appended as a whole instead of one overflow per character
+    std::streamsize xsputn(const char* s, std::streamsize count) override
+    {
+        ThreadState& state = thread_state();
+        const char* end = s + count;
+        while (s != end)
         {
-            sync();
+            auto newline = static_cast<const char*>(memchr(s, '\n', static_cast<size_t>(end - s)));
+            const char* stop = (newline != nullptr) ? newline : end;
+            if (state.do_log)
+                state.line.append(s, static_cast<size_t>(stop - s));
+            s = stop;
+            if (newline != nullptr)
+            {
+                commit(state);
+                ++s;
+            }
         }
-        return c;
+        return count;
     }
 
 private:
@@ -663,27 +839,214 @@ private:
     friend std::ostream& operator<<(std::ostream& os, const Function& function);
     friend std::ostream& operator<<(std::ostream& os, const Conditional& conditional);
 
-    std::stringstream& get_stream()
+    /// lowest severity of any sink, kept outside the instance so that checking it doesn't create the logger
+    /// Starts like update_threshold() without sinks: above fatal, nothing passes.
+    static std::atomic<int>& threshold()
+    {
+        static std::atomic<int> threshold(static_cast<int>(Severity::fatal) + 1);
+        return threshold;
+    }
+
+    /// Initial capacity of a thread's line, longer lines grow it
+    static constexpr size_t LINE_RESERVE = 1024;
+
+    /// Line that is being logged by a thread, freed when the thread exits
+    /// The line keeps its capacity from one record to the next, so logging doesn't allocate in steady state.
+    struct ThreadState
+    {
+        ThreadState()
+        {
+            line.reserve(LINE_RESERVE);
+        }
+
+        Metadata metadata;
+        bool do_log = true;
+        std::string line;
+        /// created with the thread's first record in async mode
+        std::shared_ptr<RecordQueue> queue;
+
+        ~ThreadState()
+        {
+            if (queue)
+                queue->orphaned = true;
+        }
+    };
+
+    static ThreadState& thread_state()
+    {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    void append(ThreadState& state, char c)
+    {
+        state.line.push_back(c);
+    }
+
+    /// Start a new line, the pending one is committed
+    void begin(ThreadState& state, Severity severity)
+    {
+        commit(state);
+        state.metadata.severity = severity;
+        state.metadata.timestamp = nullptr;
+        state.metadata.tag = nullptr;
+        state.metadata.function = nullptr;
+        state.do_log = true;
+    }
+
+    /// Publish the thread's pending line, a line is committed only at its end, it is never split
+    void commit(ThreadState& state)
+    {
+        if (state.line.empty())
+            return;
+        if (state.do_log)
+            publish(state, state.line);
+        // keeps the capacity
+        state.line.clear();
+    }
+
+    /// Pass message to the sinks, or queue it for the drain thread in async mode
+    void publish(ThreadState& state, const std::string& message)
+    {
+        if (!async_)
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+            for (const auto& sink : log_sinks_)
+            {
+                if (sink->filter.match(state.metadata))
+                    sink->log(state.metadata, message);
+            }
+            return;
+        }
+        if (!state.queue)
+        {
+            state.queue = std::make_shared<RecordQueue>(queue_size_);
+            std::lock_guard<std::mutex> lock(queues_mutex_);
+            queues_.push_back(state.queue);
+        }
+        Record record{state.metadata, message};
+        // the line is stamped when it is logged, not when it is drained
+        if (!record.metadata.timestamp)
+            record.metadata.timestamp = Timestamp(std::chrono::system_clock::now());
+        if (!state.queue->push(std::move(record)))
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        // drain early instead of dropping records of a burst
+        else if (state.queue->size() == state.queue->capacity() / 2)
+            drain_cv_.notify_one();
+        // async mode was stopped meanwhile, the final drain of stop_async may have missed this record
+        if (!async_)
+            drain();
+    }
+
+    void start_async(size_t queue_size, const std::chrono::milliseconds& drain_interval)
+    {
+        stop_async();
+        queue_size_ = queue_size;
+        drain_interval_ = drain_interval;
+        draining_ = true;
+        async_ = true;
+        drain_thread_ = std::thread([this] {
+            std::unique_lock<std::mutex> lock(drain_thread_mutex_);
+            bool idle = true;
+            while (draining_)
+            {
+                // keep draining without sleeping as long as records are coming in
+                if (idle)
+                    drain_cv_.wait_for(lock, drain_interval_);
+                idle = (drain() == 0);
+            }
+        });
+    }
+
+    void stop_async()
     {
-        auto id = std::this_thread::get_id();
-        if ((last_buffer_ == nullptr) || (last_id_ != id))
+        if (!drain_thread_.joinable())
+            return;
+        // before the thread is stopped, so that a commit() that still queues a record sees it and drains itself
+        async_ = false;
         {
-            last_id_ = id;
-            last_buffer_ = &(buffer_[id]);
+            std::lock_guard<std::mutex> lock(drain_thread_mutex_);
+            draining_ = false;
         }
-        return *last_buffer_;
+        drain_cv_.notify_one();
+        drain_thread_.join();
+        // records that were logged while the drain thread stopped
+        drain();
+    }
+
+    /// Move the records of all queues to the sinks, with one lock of the sinks per batch
+    /// @return the number of records
+    size_t drain()
+    {
+        std::lock_guard<std::mutex> drain_lock(drain_mutex_);
+        std::vector<std::shared_ptr<RecordQueue>> queues;
+        {
+            std::lock_guard<std::mutex> lock(queues_mutex_);
+            queues = queues_;
+        }
+        for (const auto& queue : queues)
+        {
+            // records pushed before the thread exited are all visible once orphaned is
+            bool orphaned = queue->orphaned;
+            Record record;
+            while (queue->pop(record))
+                batch_.push_back(std::move(record));
+            if (orphaned && queue->empty())
+            {
+                std::lock_guard<std::mutex> lock(queues_mutex_);
+                queues_.erase(std::remove(queues_.begin(), queues_.end(), queue), queues_.end());
+            }
+        }
+        size_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+        size_t records = batch_.size();
+        if ((records == 0) && (dropped == 0))
+            return 0;
+
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        for (const auto& record : batch_)
+        {
+            for (const auto& sink : log_sinks_)
+            {
+                if (sink->filter.match(record.metadata))
+                    sink->log(record.metadata, record.message);
+            }
+        }
+        batch_.clear();
+        if (dropped != 0)
+        {
+            Metadata metadata;
+            metadata.severity = Severity::warning;
+            metadata.tag = "AixLog";
+            metadata.timestamp = Timestamp(std::chrono::system_clock::now());
+            std::string message = "Dropped " + std::to_string(dropped) + " log records, the queue was full";
+            for (const auto& sink : log_sinks_)
+            {
+                if (sink->filter.match(metadata))
+                    sink->log(metadata, message);
+            }
+        }
+        return records;
     }
 
-    /// one buffer per thread to avoid mixed log lines
-    std::map<std::thread::id, std::stringstream> buffer_;
-    /// the last thread id
-    std::thread::id last_id_;
-    /// the last buffer
-    std::stringstream* last_buffer_ = nullptr;
-    Metadata metadata_;
-    bool do_log_;
     std::vector<log_sink_ptr> log_sinks_;
     std::recursive_mutex mutex_;
+
+    /// async mode, see init_async
+    std::atomic<bool> async_;
+    size_t queue_size_;
+    std::chrono::milliseconds drain_interval_;
+    /// queues of all threads that logged, guarded by queues_mutex_
+    std::vector<std::shared_ptr<RecordQueue>> queues_;
+    std::mutex queues_mutex_;
+    /// records dropped since the last drain
+    std::atomic<size_t> dropped_;
+    /// serializes the consumers of the queues, the drain thread, flush() and commit() after async mode was stopped
+    std::mutex drain_mutex_;
+    std::vector<Record> batch_;
+    std::thread drain_thread_;
+    std::mutex drain_thread_mutex_;
+    std::condition_variable drain_cv_;
+    bool draining_;
 };
 
 /**
@@ -1133,16 +1496,7 @@ static std::ostream& operator<<(std::ostream& os, const Severity& log_severity)
     Log* log = dynamic_cast<Log*>(os.rdbuf());
     if (log != nullptr)
     {
-        std::lock_guard<std::recursive_mutex> lock(log->mutex_);
-        if (log->metadata_.severity != log_severity)
-        {
-            log->sync();
-            log->metadata_.severity = log_severity;
-            log->metadata_.timestamp = nullptr;
-            log->metadata_.tag = nullptr;
-            log->metadata_.function = nullptr;
-            log->do_log_ = true;
-        }
+        log->begin(Log::thread_state(), log_severity);
     }
     else
     {
@@ -1156,8 +1510,7 @@ static std::ostream& operator<<(std::ostream& os, const Timestamp& timestamp)
     Log* log = dynamic_cast<Log*>(os.rdbuf());
     if (log != nullptr)
     {
-        std::lock_guard<std::recursive_mutex> lock(log->mutex_);
-        log->metadata_.timestamp = timestamp;
+        Log::thread_state().metadata.timestamp = timestamp;
     }
     else if (timestamp)
     {
@@ -1171,8 +1524,7 @@ static std::ostream& operator<<(std::ostream& os, const Tag& tag)
     Log* log = dynamic_cast<Log*>(os.rdbuf());
     if (log != nullptr)
     {
-        std::lock_guard<std::recursive_mutex> lock(log->mutex_);
-        log->metadata_.tag = tag;
+        Log::thread_state().metadata.tag = tag;
     }
     else if (tag)
     {
@@ -1186,8 +1538,7 @@ static std::ostream& operator<<(std::ostream& os, const Function& function)
     Log* log = dynamic_cast<Log*>(os.rdbuf());
     if (log != nullptr)
     {
-        std::lock_guard<std::recursive_mutex> lock(log->mutex_);
-        log->metadata_.function = function;
+        Log::thread_state().metadata.function = function;
     }
     else if (function)
     {
@@ -1201,8 +1552,7 @@ static std::ostream& operator<<(std::ostream& os, const Conditional& conditional
     Log* log = dynamic_cast<Log*>(os.rdbuf());
     if (log != nullptr)
     {
-        std::lock_guard<std::recursive_mutex> lock(log->mutex_);
-        log->do_log_ = conditional.is_true();
+        Log::thread_state().do_log = conditional.is_true();
     }
     return os;
 }
@@ -0,0 +1,433 @@
+/***
+    Binary log format for AixLog
+
+    Records are written unformatted: the severity, ids of the tag and of the call site (function, file and line),
+    the time as offset to the start of the file and the message. Tags and call sites are written once, as
+    definition records, when they are first used. A file is rendered as text offline, see tools/aixlog_decode.
+
+    Layout, integers are little endian, varints are unsigned LEB128:
+    header   magic "AIXBLOG1", u32 version, u32 header size, i64 wall clock at start in ns since epoch, u64 end of the records
+    tag      u8 Entry::Tag, varint id, varint size, text
+    site     u8 Entry::Site, varint id, varint line, varint size, function, varint size, file
+    record   u8 Entry::Record, u8 severity, varint tag id, varint site id, varint ns since start, varint size, message
+    The time of a record is taken from the steady clock, or from the record's timestamp if it has one (async mode).
+    Id 0 means no tag or no site. The end offset in the header is updated after every record, so a file of a
+    process that crashed can be read up to the last complete record.
+***/
+
+#ifndef AIX_LOG_BINARY_HPP
+#define AIX_LOG_BINARY_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+
+#include "common/aixlog.hpp"
+#include "common/snap_exception.hpp"
+
+
+namespace AixLog
+{
+namespace binary
+{
+
+static constexpr char MAGIC[8] = {'A', 'I', 'X', 'B', 'L', 'O', 'G', '1'};
+static constexpr uint32_t VERSION = 1;
+
+/// Type of an entry in the file, the first byte of each entry
+enum class Entry : uint8_t
+{
+    Tag = 1,
+    Site = 2,
+    Record = 3
+};
+
+#pragma pack(push, 1)
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    int64_t start_ns;
+    uint64_t end;
+};
+#pragma pack(pop)
+
+static inline void put_varint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static inline void put_string(std::string& out, const std::string& text)
+{
+    put_varint(out, text.size());
+    out.append(text);
+}
+
+/// Sequential reader of a binary log file's records, throws SnapException on a malformed file
+class Reader
+{
+public:
+    using time_point_sys_clock = std::chrono::time_point<std::chrono::system_clock>;
+
+    /// @param data the whole file
+    explicit Reader(std::string data) : data_(std::move(data)), pos_(sizeof(Header))
+    {
+        if ((data_.size() < sizeof(Header)) || (memcmp(data_.data(), MAGIC, sizeof(MAGIC)) != 0))
+            throw SnapException("Not a binary log file");
+        memcpy(&header_, data_.data(), sizeof(Header));
+        if (header_.version != VERSION)
+            throw SnapException("Unsupported binary log version " + std::to_string(header_.version));
+        pos_ = header_.header_size;
+        end_ = std::min<uint64_t>(header_.end, data_.size());
+    }
+
+    /// Read the next log record, definitions are collected on the way
+    /// @return false at the end of the file
+    bool next(Metadata& metadata, std::string& message)
+    {
+        while (pos_ < end_)
+        {
+            auto type = static_cast<Entry>(data_[pos_++]);
+            if (type == Entry::Tag)
+            {
+                uint64_t id = varint();
+                tags_[id] = text();
+            }
+            else if (type == Entry::Site)
+            {
+                uint64_t id = varint();
+                auto line = static_cast<size_t>(varint());
+                std::string function = text();
+                std::string file = text();
+                sites_[id] = std::make_tuple(std::move(function), std::move(file), line);
+            }
+            else if (type == Entry::Record)
+            {
+                if (pos_ >= end_)
+                    throw SnapException("Truncated record at " + std::to_string(pos_));
+                metadata = Metadata();
+                metadata.severity = static_cast<Severity>(data_[pos_++]);
+                uint64_t tag = varint();
+                uint64_t site = varint();
+                uint64_t ns = varint();
+                message = text();
+                if (tag != 0)
+                    metadata.tag = Tag(tags_.at(tag));
+                if (site != 0)
+                {
+                    const auto& s = sites_.at(site);
+                    metadata.function = Function(std::get<0>(s), std::get<1>(s), std::get<2>(s));
+                }
+                metadata.timestamp = Timestamp(time_point_sys_clock(
+                    std::chrono::duration_cast<time_point_sys_clock::duration>(std::chrono::nanoseconds(header_.start_ns + static_cast<int64_t>(ns)))));
+                return true;
+            }
+            else
+            {
+                throw SnapException("Unknown entry type " + std::to_string(static_cast<int>(type)) + " at " + std::to_string(pos_ - 1));
+            }
+        }
+        return false;
+    }
+
+private:
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            if (pos_ >= end_)
+                break;
+            auto byte = static_cast<uint8_t>(data_[pos_++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                return value;
+        }
+        throw SnapException("Malformed varint at " + std::to_string(pos_));
+    }
+
+    std::string text()
+    {
+        uint64_t size = varint();
+        if (size > end_ - pos_)
+            throw SnapException("Truncated string at " + std::to_string(pos_));
+        std::string result(data_, pos_, size);
+        pos_ += size;
+        return result;
+    }
+
+    std::string data_;
+    Header header_;
+    size_t pos_;
+    size_t end_;
+    std::map<uint64_t, std::string> tags_;
+    std::map<uint64_t, std::tuple<std::string, std::string, size_t>> sites_;
+};
+
+} // namespace binary
+
+
+/**
+ * @brief
+ * Unformatted logging to a memory mapped file
+ *
+ * Nothing is formatted while logging: no strftime, no pattern substitution, tags and call sites are written
+ * once and referenced by id. The file grows in steps of grow_size. Once it would exceed max_size it is renamed
+ * to <filename>.old, replacing an older one, and a new file is started. A non-empty file that exists at construction
+ * is renamed to <filename>.old as well, so the log of a process that crashed survives the restart.
+ * Like every sink, log() is called with the logger's lock held.
+ */
+struct SinkBinary : public Sink
+{
+    SinkBinary(const Filter& filter, const std::string& filename, size_t max_size = 8 * 1024 * 1024, size_t grow_size = 256 * 1024)
+        : Sink(filter), filename_(filename), max_size_(std::max(max_size, sizeof(binary::Header) + 4096)), grow_size_(std::max<size_t>(grow_size, 4096)),
+          fd_(-1), data_(nullptr), mapped_(0), end_(0), failed_(false)
+    {
+        struct stat st;
+        if ((stat(filename_.c_str(), &st) == 0) && (st.st_size > 0))
+            keep_old();
+        if (!open())
+            throw SnapException("SinkBinary - Failed to open " + filename_ + ": " + strerror(errno));
+    }
+
+    ~SinkBinary() override
+    {
+        close();
+    }
+
+    /// Records are dropped while the file can't be written, e.g. on a full partition, with one message to stderr
+    void log(const Metadata& metadata, const std::string& message) override
+    {
+        // a file that couldn't be reopened after a rotation is tried again with every record
+        if ((data_ == nullptr) && !open())
+        {
+            drop("open");
+            return;
+        }
+        record_.clear();
+        uint64_t tag = 0;
+        if (metadata.tag)
+            tag = tag_id(metadata.tag.text);
+        uint64_t site = 0;
+        if (metadata.function)
+            site = site_id(metadata.function);
+
+        auto ns = metadata.timestamp ? std::chrono::duration_cast<std::chrono::nanoseconds>(metadata.timestamp.time_point - start_).count()
+                                     : std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - steady_start_).count();
+        record_.push_back(static_cast<char>(binary::Entry::Record));
+        record_.push_back(static_cast<char>(metadata.severity));
+        binary::put_varint(record_, tag);
+        binary::put_varint(record_, site);
+        binary::put_varint(record_, static_cast<uint64_t>(std::max<int64_t>(ns, 0)));
+        binary::put_string(record_, message);
+
+        Reserve reserved = reserve(definitions_.size() + record_.size());
+        if (reserved == Reserve::Full)
+        {
+            // the definitions belong to the old file, they are written again into the new one
+            // a new file is never full, so this recurses once at most
+            rotate();
+            if (data_ == nullptr)
+                drop("open");
+            else
+                log(metadata, message);
+            return;
+        }
+        if (reserved == Reserve::Failed)
+        {
+            drop("grow");
+            return;
+        }
+        append(definitions_);
+        definitions_.clear();
+        append(record_);
+        commit();
+        failed_ = false;
+    }
+
+private:
+    enum class Reserve
+    {
+        Ok,
+        /// the file would grow beyond max_size
+        Full,
+        /// the file couldn't be grown or mapped
+        Failed
+    };
+
+    /// @return false if the file can't be created, errno tells why
+    bool open()
+    {
+        fd_ = ::open(filename_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+            return false;
+        start_ = std::chrono::system_clock::now();
+        steady_start_ = std::chrono::steady_clock::now();
+        end_ = 0;
+        if (reserve(sizeof(binary::Header)) != Reserve::Ok)
+        {
+            int error = errno;
+            ::close(fd_);
+            fd_ = -1;
+            errno = error;
+            return false;
+        }
+        binary::Header header;
+        memcpy(header.magic, binary::MAGIC, sizeof(header.magic));
+        header.version = binary::VERSION;
+        header.header_size = sizeof(binary::Header);
+        header.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start_.time_since_epoch()).count();
+        header.end = sizeof(binary::Header);
+        memcpy(data_, &header, sizeof(header));
+        end_ = sizeof(header);
+        return true;
+    }
+
+    /// Report the first of a series of dropped records
+    void drop(const char* what)
+    {
+        if (!failed_)
+            std::cerr << "SinkBinary - Failed to " << what << " " << filename_ << ", dropping records: " << strerror(errno) << "\n";
+        failed_ = true;
+    }
+
+    /// Unmap and cut the file to its records
+    void close()
+    {
+        if (data_ != nullptr)
+            munmap(data_, mapped_);
+        data_ = nullptr;
+        mapped_ = 0;
+        if (fd_ >= 0)
+        {
+            if (ftruncate(fd_, static_cast<off_t>(end_)) != 0)
+                std::cerr << "SinkBinary - Failed to truncate " << filename_ << ": " << strerror(errno) << "\n";
+            ::close(fd_);
+        }
+        fd_ = -1;
+        tags_.clear();
+        sites_.clear();
+        definitions_.clear();
+    }
+
+    void rotate()
+    {
+        close();
+        keep_old();
+        open();
+    }
+
+    /// Rename the file to <filename>.old, replacing an older one
+    void keep_old()
+    {
+        std::string old = filename_ + ".old";
+        if (rename(filename_.c_str(), old.c_str()) != 0)
+            std::cerr << "SinkBinary - Failed to rename " << filename_ << ": " << strerror(errno) << "\n";
+    }
+
+    /// Map at least size more bytes
+    /// The blocks are allocated, not just a sparse file, so writing through the mapping can't raise SIGBUS on a full partition
+    Reserve reserve(size_t size)
+    {
+        if (end_ + size <= mapped_)
+            return Reserve::Ok;
+        if ((end_ + size > max_size_) && (end_ > sizeof(binary::Header)))
+            return Reserve::Full;
+        size_t mapped = std::min(std::max(mapped_ + grow_size_, end_ + size), std::max(max_size_, end_ + size));
+        int error = posix_fallocate(fd_, static_cast<off_t>(mapped_), static_cast<off_t>(mapped - mapped_));
+        if (error != 0)
+        {
+            errno = error;
+            return Reserve::Failed;
+        }
+        void* data = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (data == MAP_FAILED)
+            return Reserve::Failed;
+        if (data_ != nullptr)
+            munmap(data_, mapped_);
+        data_ = static_cast<char*>(data);
+        mapped_ = mapped;
+        return Reserve::Ok;
+    }
+
+    void append(const std::string& bytes)
+    {
+        memcpy(data_ + end_, bytes.data(), bytes.size());
+        end_ += bytes.size();
+    }
+
+    /// Publish the records up to end_ in the header
+    void commit()
+    {
+        uint64_t end = end_;
+        memcpy(data_ + offsetof(binary::Header, end), &end, sizeof(end));
+    }
+
+    uint64_t tag_id(const std::string& tag)
+    {
+        auto it = tags_.find(tag);
+        if (it != tags_.end())
+            return it->second;
+        uint64_t id = tags_.size() + 1;
+        tags_.emplace(tag, id);
+        definitions_.push_back(static_cast<char>(binary::Entry::Tag));
+        binary::put_varint(definitions_, id);
+        binary::put_string(definitions_, tag);
+        return id;
+    }
+
+    uint64_t site_id(const Function& function)
+    {
+        auto key = std::make_tuple(function.file, function.line, function.name);
+        auto it = sites_.find(key);
+        if (it != sites_.end())
+            return it->second;
+        uint64_t id = sites_.size() + 1;
+        sites_.emplace(std::move(key), id);
+        definitions_.push_back(static_cast<char>(binary::Entry::Site));
+        binary::put_varint(definitions_, id);
+        binary::put_varint(definitions_, function.line);
+        binary::put_string(definitions_, function.name);
+        binary::put_string(definitions_, function.file);
+        return id;
+    }
+
+    std::string filename_;
+    size_t max_size_;
+    size_t grow_size_;
+    int fd_;
+    char* data_;
+    size_t mapped_;
+    /// end of the records that have been written
+    size_t end_;
+    std::chrono::time_point<std::chrono::system_clock> start_;
+    std::chrono::steady_clock::time_point steady_start_;
+    std::map<std::string, uint64_t> tags_;
+    std::map<std::tuple<std::string, size_t, std::string>, uint64_t> sites_;
+    /// definitions of tags and sites that the next record introduces
+    std::string definitions_;
+    /// reused for every record
+    std::string record_;
+    /// records are being dropped, the failure has been reported
+    bool failed_;
+};
+
+} // namespace AixLog
+
+#endif // AIX_LOG_BINARY_HPP
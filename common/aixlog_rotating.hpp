@@ -0,0 +1,337 @@
+/***
+    Rotating file sink for AixLog
+***/
+
+#ifndef AIX_LOG_ROTATING_HPP
+#define AIX_LOG_ROTATING_HPP
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#include "common/aixlog.hpp"
+#include "common/snap_exception.hpp"
+
+
+namespace AixLog
+{
+
+/**
+ * @brief
+ * Limits and flush policy of a SinkRotatingFile
+ */
+struct RotatingFileOptions
+{
+    /// When the file is synced to storage
+    enum class Fsync
+    {
+        /// leave it to the OS
+        Never,
+        /// before a file is rotated
+        Rotate,
+        /// after every write, survives a crash of the unit at the cost of flash wear
+        Flush
+    };
+
+    size_t max_size = 1024 * 1024;
+    /// 0 to rotate by size only
+    std::chrono::seconds max_age = std::chrono::hours(24);
+    /// rotated files to keep, the current file is not counted
+    size_t max_files = 5;
+    bool compress = true;
+    size_t buffer_size = 64 * 1024;
+    std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000);
+    Severity flush_severity = Severity::warning;
+    Fsync fsync = Fsync::Rotate;
+};
+
+/**
+ * @brief
+ * Formatted logging to a file that is rotated by size and age
+ *
+ * The file is appended to, so a restart doesn't wipe the previous log. Once it reaches max_size, or is older
+ * than max_age, it is renamed to <filename>.<YYYYmmdd-HHMMSS> and a new file is started. Rotated files are
+ * compressed to .gz by a background thread (if built with zlib), only the newest max_files rotated files are kept.
+ * Lines are buffered and written once the buffer is full, when a line of flush_severity or higher is logged,
+ * or after flush_interval, so a burst of lines costs one write instead of one per line.
+ * Lines are dropped while the file can't be written or reopened, e.g. on a full partition, with one message to stderr.
+ */
+struct SinkRotatingFile : public SinkFormat
+{
+    using Options = RotatingFileOptions;
+    using Fsync = RotatingFileOptions::Fsync;
+
+    SinkRotatingFile(const Filter& filter, const std::string& filename, const Options& options = Options(),
+                     const std::string& format = "%Y-%m-%d %H-%M-%S.#ms [#severity] (#tag_func)")
+        : SinkFormat(filter, format), filename_(filename), options_(options), fd_(-1), size_(0), sequence_(0), running_(true), failed_(false)
+    {
+        if (!open())
+            throw SnapException("SinkRotatingFile - Failed to open " + filename_ + ": " + strerror(errno));
+        worker_ = std::thread([this] { work(); });
+    }
+
+    ~SinkRotatingFile() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_one();
+        worker_.join();
+        std::lock_guard<std::mutex> lock(mutex_);
+        flush(options_.fsync != Fsync::Never);
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    void log(const Metadata& metadata, const std::string& message) override
+    {
+        line_.str("");
+        do_log(line_, metadata, message);
+        std::lock_guard<std::mutex> lock(mutex_);
+        // a file that couldn't be reopened after a rotation is tried again with every line
+        if ((fd_ < 0) && !open())
+        {
+            drop("open");
+            return;
+        }
+        buffer_ += line_.str();
+        auto now = std::chrono::steady_clock::now();
+        if ((size_ + buffer_.size() >= options_.max_size) || ((options_.max_age.count() > 0) && (now - opened_ >= options_.max_age)))
+            rotate();
+        else if ((buffer_.size() >= options_.buffer_size) || (metadata.severity >= options_.flush_severity))
+            flush(options_.fsync == Fsync::Flush);
+    }
+
+private:
+    /// @return false if the file can't be opened, errno tells why
+    bool open()
+    {
+        fd_ = ::open(filename_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+            return false;
+        struct stat st;
+        bool found = (fstat(fd_, &st) == 0);
+        size_ = found ? static_cast<size_t>(st.st_size) : 0;
+        opened_ = std::chrono::steady_clock::now();
+        // a file that is appended to after a restart keeps its age, max_age is measured on the steady clock from here on
+        if (found && (size_ > 0))
+        {
+            auto age = std::chrono::system_clock::now() - std::chrono::system_clock::from_time_t(st.st_mtime);
+            if (age > std::chrono::system_clock::duration::zero())
+                opened_ -= std::chrono::duration_cast<std::chrono::steady_clock::duration>(age);
+        }
+        return true;
+    }
+
+    /// Report the first of a series of dropped lines, called with mutex_ held
+    void drop(const char* what)
+    {
+        if (!failed_)
+            std::cerr << "SinkRotatingFile - Failed to " << what << " " << filename_ << ", dropping lines: " << strerror(errno) << "\n";
+        failed_ = true;
+    }
+
+    /// Write the buffer to the file, called with mutex_ held
+    void flush(bool sync)
+    {
+        if (fd_ < 0)
+        {
+            buffer_.clear();
+            return;
+        }
+        size_t written = 0;
+        while (written < buffer_.size())
+        {
+            ssize_t n = ::write(fd_, buffer_.data() + written, buffer_.size() - written);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                // e.g. the partition is full, the lines are lost but logging goes on
+                drop("write");
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+        if ((written > 0) && (written == buffer_.size()))
+            failed_ = false;
+        size_ += written;
+        buffer_.clear();
+        last_flush_ = std::chrono::steady_clock::now();
+        if (sync && (written > 0))
+            fdatasync(fd_);
+    }
+
+    /// Flush and close the file, rename it and start a new one, called with mutex_ held
+    void rotate()
+    {
+        flush(options_.fsync != Fsync::Never);
+        ::close(fd_);
+        std::string rotated = rotated_name();
+        if (rename(filename_.c_str(), rotated.c_str()) != 0)
+            std::cerr << "SinkRotatingFile - Failed to rename " << filename_ << ": " << strerror(errno) << "\n";
+        else
+            rotated_.push_back(rotated);
+        fd_ = -1;
+        if (!open())
+            drop("open");
+        cv_.notify_one();
+    }
+
+    /// @return <filename>.<YYYYmmdd-HHMMSS>, with a counter -NNN for further files of the same second
+    /// The counter doesn't restart when a file of that second has been pruned, so the names keep sorting by time.
+    std::string rotated_name()
+    {
+        std::string stamp = Timestamp(std::chrono::system_clock::now()).to_string("%Y%m%d-%H%M%S");
+        if (stamp == last_stamp_)
+        {
+            ++sequence_;
+        }
+        else
+        {
+            last_stamp_ = stamp;
+            sequence_ = 0;
+        }
+        while (true)
+        {
+            std::string result = filename_ + "." + stamp;
+            if (sequence_ > 0)
+            {
+                char counter[24];
+                snprintf(counter, sizeof(counter), "-%03zu", sequence_);
+                result += counter;
+            }
+            struct stat st;
+            if ((stat(result.c_str(), &st) != 0) && (stat((result + ".gz").c_str(), &st) != 0))
+                return result;
+            ++sequence_;
+        }
+    }
+
+    /// Background thread: compresses rotated files, removes old ones and flushes the buffer after flush_interval
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (running_ || !rotated_.empty())
+        {
+            cv_.wait_for(lock, options_.flush_interval, [this] { return !running_ || !rotated_.empty(); });
+            if (!buffer_.empty() && (std::chrono::steady_clock::now() - last_flush_ >= options_.flush_interval))
+                flush(options_.fsync == Fsync::Flush);
+            if (!rotated_.empty())
+            {
+                std::deque<std::string> rotated;
+                rotated.swap(rotated_);
+                // logging goes on while files are compressed
+                lock.unlock();
+                for (const auto& file : rotated)
+                {
+                    if (options_.compress)
+                        compress(file);
+                }
+                prune();
+                lock.lock();
+            }
+        }
+    }
+
+    void compress(const std::string& file)
+    {
+#ifdef HAS_ZLIB
+        std::string tmp = file + ".gz.tmp";
+        int in = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        gzFile out = gzopen(tmp.c_str(), "wb6");
+        bool ok = (in >= 0) && (out != nullptr);
+        char chunk[64 * 1024];
+        ssize_t n = 0;
+        while (ok && ((n = ::read(in, chunk, sizeof(chunk))) > 0))
+            ok = (gzwrite(out, chunk, static_cast<unsigned>(n)) == n);
+        ok = ok && (n == 0);
+        if (out != nullptr)
+            ok = (gzclose(out) == Z_OK) && ok;
+        if (in >= 0)
+            ::close(in);
+        if (ok && (rename(tmp.c_str(), (file + ".gz").c_str()) == 0))
+        {
+            unlink(file.c_str());
+            return;
+        }
+        std::cerr << "SinkRotatingFile - Failed to compress " << file << "\n";
+        unlink(tmp.c_str());
+#else
+        (void)file;
+#endif
+    }
+
+    /// Remove all but the newest max_files rotated files
+    void prune()
+    {
+        auto slash = filename_.rfind('/');
+        std::string dir = (slash == std::string::npos) ? "." : filename_.substr(0, slash);
+        std::string prefix = ((slash == std::string::npos) ? filename_ : filename_.substr(slash + 1)) + ".";
+        DIR* d = opendir(dir.c_str());
+        if (d == nullptr)
+            return;
+        std::vector<std::string> files;
+        while (struct dirent* entry = readdir(d))
+        {
+            std::string name = entry->d_name;
+            // rotated names start with the date, a digit, which skips e.g. the .gz.tmp of a file being compressed
+            if ((name.compare(0, prefix.size(), prefix) == 0) && (name.size() > prefix.size()) && isdigit(static_cast<unsigned char>(name[prefix.size()])) &&
+                (name.find(".tmp") == std::string::npos))
+                files.push_back(name);
+        }
+        closedir(d);
+        if (files.size() <= options_.max_files)
+            return;
+        // without .gz the names sort by the time of rotation
+        auto key = [](const std::string& name) { return (name.size() > 3) && (name.compare(name.size() - 3, 3, ".gz") == 0) ? name.substr(0, name.size() - 3) : name; };
+        std::sort(files.begin(), files.end(), [&key](const std::string& lhs, const std::string& rhs) { return key(lhs) < key(rhs); });
+        for (size_t n = 0; n < files.size() - options_.max_files; ++n)
+            unlink((dir + "/" + files[n]).c_str());
+    }
+
+    std::string filename_;
+    Options options_;
+    /// guards everything below but line_, which is used by log() only, under the logger's lock
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int fd_;
+    /// bytes in the file
+    size_t size_;
+    std::chrono::steady_clock::time_point opened_;
+    std::chrono::steady_clock::time_point last_flush_;
+    std::string buffer_;
+    /// rotated files waiting for compression
+    std::deque<std::string> rotated_;
+    /// second and counter of the last rotated file
+    std::string last_stamp_;
+    size_t sequence_;
+    bool running_;
+    /// lines are being dropped, the failure has been reported
+    bool failed_;
+    std::ostringstream line_;
+    std::thread worker_;
+};
+
+} // namespace AixLog
+
+#endif // AIX_LOG_ROTATING_HPP
@@ -0,0 +1,153 @@
+#ifndef ASIO_REACTOR_HPP
+#define ASIO_REACTOR_HPP
+
+#include <boost/asio.hpp>
+#include <map>
+#include <memory>
+
+#include "common/reactor.hpp"
+
+
+/// Reactor on top of a boost::asio io_context
+/// File descriptors are wrapped in posix::stream_descriptors without taking ownership, so that sockets
+/// owned by other libraries (e.g. DNS-SD) are driven by the io_context threads like any asio socket.
+/// Handlers are serialized on the reactor's strand, the reactor must only be used from within it.
+class AsioReactor : public Reactor
+{
+public:
+    using strand_type = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+    explicit AsioReactor(boost::asio::io_context& io) : io_(io), strand_(boost::asio::make_strand(io)), next_timer_id_(1)
+    {
+    }
+
+    ~AsioReactor() override
+    {
+        for (auto& watch : fds_)
+            release(*watch.second);
+        for (auto& timer : timers_)
+            release(*timer.second);
+    }
+
+    AsioReactor(const AsioReactor&) = delete;
+    AsioReactor& operator=(const AsioReactor&) = delete;
+
+    strand_type& strand()
+    {
+        return strand_;
+    }
+
+    void add(int fd, Handler handler, uint32_t events = EPOLLIN) override
+    {
+        remove(fd);
+        auto watch = std::make_shared<Watch>(io_, fd, std::move(handler));
+        fds_[fd] = watch;
+        if ((events & EPOLLIN) != 0)
+            wait(watch, boost::asio::posix::stream_descriptor::wait_read);
+        if ((events & EPOLLOUT) != 0)
+            wait(watch, boost::asio::posix::stream_descriptor::wait_write);
+    }
+
+    void modify(int fd, uint32_t events) override
+    {
+        auto it = fds_.find(fd);
+        if (it == fds_.end())
+            return;
+        Handler handler = it->second->handler;
+        add(fd, std::move(handler), events);
+    }
+
+    void remove(int fd) override
+    {
+        auto it = fds_.find(fd);
+        if (it == fds_.end())
+            return;
+        release(*it->second);
+        fds_.erase(it);
+    }
+
+    size_t addTimer(const Clock::time_point& deadline, TimerHandler handler) override
+    {
+        size_t id = next_timer_id_++;
+        auto timer = std::make_shared<Timer>(io_, deadline);
+        timers_[id] = timer;
+        timer->timer.async_wait(boost::asio::bind_executor(strand_, [this, id, timer, handler](const boost::system::error_code& ec) {
+            // A timer that expired with its handler queued before it was cancelled, or before the reactor was
+            // destroyed, completes without error. It must neither fire nor touch the reactor, which might be gone.
+            if (ec || !timer->active)
+                return;
+            timers_.erase(id);
+            handler();
+        }));
+        return id;
+    }
+
+    void cancelTimer(size_t id) override
+    {
+        auto it = timers_.find(id);
+        if (it == timers_.end())
+            return;
+        release(*it->second);
+        timers_.erase(it);
+    }
+
+private:
+    struct Watch
+    {
+        Watch(boost::asio::io_context& io, int fd, Handler handler) : descriptor(io, fd), handler(std::move(handler)), active(true)
+        {
+        }
+
+        boost::asio::posix::stream_descriptor descriptor;
+        Handler handler;
+        bool active;
+    };
+
+    struct Timer
+    {
+        Timer(boost::asio::io_context& io, const Clock::time_point& deadline) : timer(io, deadline), active(true)
+        {
+        }
+
+        boost::asio::steady_timer timer;
+        bool active;
+    };
+
+    void wait(const std::shared_ptr<Watch>& watch, boost::asio::posix::stream_descriptor::wait_type type)
+    {
+        watch->descriptor.async_wait(type, boost::asio::bind_executor(strand_, [this, watch, type](const boost::system::error_code& ec) {
+            // the watch stays alive until its handlers completed, even if it has been removed
+            if (!watch->active || (ec == boost::asio::error::operation_aborted))
+                return;
+            uint32_t events = ec ? EPOLLERR : ((type == boost::asio::posix::stream_descriptor::wait_read) ? EPOLLIN : EPOLLOUT);
+            watch->handler(events);
+            if (watch->active && !ec)
+                wait(watch, type);
+        }));
+    }
+
+    /// Cancel pending waits and hand the fd back to its owner without closing it
+    static void release(Watch& watch)
+    {
+        watch.active = false;
+        boost::system::error_code ec;
+        watch.descriptor.cancel(ec);
+        watch.descriptor.release();
+    }
+
+    /// Cancel a timer, its handler is not called even if it is queued already
+    static void release(Timer& timer)
+    {
+        timer.active = false;
+        timer.timer.cancel();
+    }
+
+    boost::asio::io_context& io_;
+    strand_type strand_;
+    size_t next_timer_id_;
+    std::map<int, std::shared_ptr<Watch>> fds_;
+    std::map<size_t, std::shared_ptr<Timer>> timers_;
+};
+
+
+#endif
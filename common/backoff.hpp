@@ -0,0 +1,46 @@
+#ifndef BACKOFF_HPP
+#define BACKOFF_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+
+/// Exponential backoff with "equal jitter"
+/// The n-th delay is uniformly distributed in [cap / 2, cap] with cap = min(max, initial * 2^n). The random part
+/// spreads the reconnects of many clients that lost their server at the same time, the fixed part keeps a
+/// single client from retrying right away.
+class Backoff
+{
+public:
+    Backoff(std::chrono::milliseconds initial, std::chrono::milliseconds max) : initial_(initial), max_(max), attempt_(0), rng_(std::random_device{}())
+    {
+    }
+
+    /// @return the delay before the next attempt
+    std::chrono::milliseconds next()
+    {
+        auto cap = initial_;
+        for (size_t n = 0; (n < attempt_) && (cap < max_); ++n)
+            cap *= 2;
+        cap = std::min(cap, max_);
+        ++attempt_;
+        std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(0, cap.count() / 2);
+        return cap - std::chrono::milliseconds(jitter(rng_));
+    }
+
+    /// Start over with the initial delay, e.g. after a successful connect
+    void reset()
+    {
+        attempt_ = 0;
+    }
+
+private:
+    std::chrono::milliseconds initial_;
+    std::chrono::milliseconds max_;
+    size_t attempt_;
+    std::mt19937 rng_;
+};
+
+
+#endif
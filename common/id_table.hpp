@@ -0,0 +1,155 @@
+#ifndef ID_TABLE_HPP
+#define ID_TABLE_HPP
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+/// Open addressing hash table from 32 bit ids to values, with linear probing
+/// Made for ids that are handed out sequentially: consecutive ids land in consecutive slots, so lookups
+/// rarely probe more than one slot. The table only allocates when it grows.
+template <typename T>
+class IdTable
+{
+public:
+    explicit IdTable(size_t capacity = 64) : slots_(roundUp(capacity)), used_(0), deleted_(0)
+    {
+    }
+
+    size_t size() const
+    {
+        return used_;
+    }
+
+    bool empty() const
+    {
+        return used_ == 0;
+    }
+
+    /// Insert value for id, an existing value for id is replaced
+    void insert(uint32_t id, T value)
+    {
+        // keep the load, including tombstones, below 1/2
+        if (2 * (used_ + deleted_ + 1) > slots_.size())
+            rehash((2 * (used_ + 1) > slots_.size() / 2) ? 2 * slots_.size() : slots_.size());
+        size_t mask = slots_.size() - 1;
+        size_t tombstone = slots_.size();
+        for (size_t n = id & mask;; n = (n + 1) & mask)
+        {
+            Slot& slot = slots_[n];
+            if ((slot.state == State::Used) && (slot.id == id))
+            {
+                slot.value = std::move(value);
+                return;
+            }
+            if ((slot.state == State::Deleted) && (tombstone == slots_.size()))
+                tombstone = n;
+            if (slot.state == State::Empty)
+            {
+                Slot& target = (tombstone != slots_.size()) ? slots_[tombstone] : slot;
+                if (target.state == State::Deleted)
+                    --deleted_;
+                target.id = id;
+                target.value = std::move(value);
+                target.state = State::Used;
+                ++used_;
+                return;
+            }
+        }
+    }
+
+    /// @return the value of id, nullptr if there is none
+    T* find(uint32_t id)
+    {
+        size_t n = index(id);
+        return (n == slots_.size()) ? nullptr : &slots_[n].value;
+    }
+
+    /// Move the value of id to value and remove it
+    /// @return false if there is no value for id
+    bool take(uint32_t id, T& value)
+    {
+        size_t n = index(id);
+        if (n == slots_.size())
+            return false;
+        Slot& slot = slots_[n];
+        value = std::move(slot.value);
+        slot.value = T();
+        slot.state = State::Deleted;
+        --used_;
+        ++deleted_;
+        return true;
+    }
+
+    /// Call fn(id, value) for every entry
+    template <typename F>
+    void forEach(F fn)
+    {
+        for (auto& slot : slots_)
+            if (slot.state == State::Used)
+                fn(slot.id, slot.value);
+    }
+
+    void clear()
+    {
+        for (auto& slot : slots_)
+        {
+            slot.state = State::Empty;
+            slot.value = T();
+        }
+        used_ = 0;
+        deleted_ = 0;
+    }
+
+private:
+    enum class State : uint8_t
+    {
+        Empty,
+        Used,
+        Deleted
+    };
+
+    struct Slot
+    {
+        uint32_t id = 0;
+        State state = State::Empty;
+        T value;
+    };
+
+    static size_t roundUp(size_t n)
+    {
+        size_t capacity = 8;
+        while (capacity < n)
+            capacity *= 2;
+        return capacity;
+    }
+
+    /// @return the slot of id, slots_.size() if there is none
+    size_t index(uint32_t id) const
+    {
+        size_t mask = slots_.size() - 1;
+        for (size_t n = id & mask; slots_[n].state != State::Empty; n = (n + 1) & mask)
+            if ((slots_[n].state == State::Used) && (slots_[n].id == id))
+                return n;
+        return slots_.size();
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<Slot> slots(capacity);
+        slots.swap(slots_);
+        used_ = 0;
+        deleted_ = 0;
+        for (auto& slot : slots)
+            if (slot.state == State::Used)
+                insert(slot.id, std::move(slot.value));
+    }
+
+    std::vector<Slot> slots_;
+    size_t used_;
+    size_t deleted_;
+};
+
+
+#endif
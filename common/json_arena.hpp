@@ -0,0 +1,227 @@
+#ifndef JSON_ARENA_HPP
+#define JSON_ARENA_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+
+namespace jsonrpcpp
+{
+
+/// Monotonic buffer for the nodes of a Json DOM
+/// A connection parses every message into its arena and resets it after the message is dispatched, so the
+/// parse path doesn't allocate once the arena has grown to the size of the largest message.
+/// nlohmann's allocators are stateless, the ArenaAllocator uses the arena that is current on its thread (see Scope)
+/// and the heap if there is none. Every allocation knows where it came from, so Json values may be destroyed
+/// anywhere. Blocks that still hold values when the arena is reset are handed over to those values and freed
+/// with the last of them, values that outlive the dispatch stay valid.
+/// An arena is used by one thread at a time, values from it may be destroyed on any thread.
+class JsonArena
+{
+public:
+    /// @param blockSize size of the arena's blocks, larger allocations go to the heap
+    explicit JsonArena(size_t blockSize = 16 * 1024) : blockSize_(blockSize), current_(0)
+    {
+    }
+
+    ~JsonArena()
+    {
+        for (auto* block : blocks_)
+            if (retire(block))
+                std::free(block);
+    }
+
+    JsonArena(const JsonArena&) = delete;
+    JsonArena& operator=(const JsonArena&) = delete;
+
+    /// Makes an arena the current one of this thread for its lifetime
+    class Scope
+    {
+    public:
+        explicit Scope(JsonArena& arena) : previous_(current())
+        {
+            current() = &arena;
+        }
+
+        ~Scope()
+        {
+            current() = previous_;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        JsonArena* previous_;
+    };
+
+    /// @return the current arena of this thread, nullptr if there is none
+    static JsonArena*& current()
+    {
+        thread_local JsonArena* arena = nullptr;
+        return arena;
+    }
+
+    /// Allocate from the current arena of this thread, or from the heap if there is none
+    static void* allocate_current(size_t size)
+    {
+        JsonArena* arena = current();
+        return (arena != nullptr) ? arena->allocate(size) : allocate_heap(size);
+    }
+
+    void* allocate(size_t size)
+    {
+        size_t needed = HEADER_SIZE + align(size);
+        if (needed > blockSize_ / 4)
+            return allocate_heap(size);
+        while ((current_ < blocks_.size()) && (blocks_[current_]->used + needed > blockSize_))
+            ++current_;
+        if (current_ == blocks_.size())
+        {
+            void* memory = std::malloc(sizeof(Block) + blockSize_);
+            if (memory == nullptr)
+                throw std::bad_alloc();
+            blocks_.push_back(new (memory) Block());
+        }
+        Block* block = blocks_[current_];
+        char* p = block->data() + block->used;
+        block->used += needed;
+        block->state.fetch_add(1, std::memory_order_relaxed);
+        reinterpret_cast<Header*>(p)->block = block;
+        return p + HEADER_SIZE;
+    }
+
+    /// Free p, which may come from any arena or from the heap
+    static void deallocate(void* p)
+    {
+        if (p == nullptr)
+            return;
+        auto* header = reinterpret_cast<Header*>(static_cast<char*>(p) - HEADER_SIZE);
+        Block* block = header->block;
+        if (block == nullptr)
+            std::free(header);
+        // the last value of a retired block frees it
+        else if (block->state.fetch_sub(1, std::memory_order_acq_rel) == (RETIRED | 1))
+            std::free(block);
+    }
+
+    /// Start over, blocks that still hold values are replaced
+    void reset()
+    {
+        size_t kept = 0;
+        for (auto* block : blocks_)
+        {
+            if (retire(block))
+            {
+                // no values left, the block is reused
+                block->state.store(0, std::memory_order_relaxed);
+                block->used = 0;
+                blocks_[kept++] = block;
+            }
+        }
+        blocks_.resize(kept);
+        current_ = 0;
+    }
+
+    /// @return the number of blocks owned by the arena
+    size_t blocks() const
+    {
+        return blocks_.size();
+    }
+
+private:
+    static constexpr size_t RETIRED = size_t(1) << (sizeof(size_t) * 8 - 1);
+    static constexpr size_t HEADER_SIZE = 16;
+
+    struct Block
+    {
+        /// number of live values, RETIRED once the arena has let go of the block
+        std::atomic<size_t> state{0};
+        size_t used{0};
+
+        char* data()
+        {
+            return reinterpret_cast<char*>(this) + sizeof(Block);
+        }
+    };
+
+    struct Header
+    {
+        /// nullptr for heap allocations
+        Block* block;
+    };
+
+    static_assert(sizeof(Block) % HEADER_SIZE == 0, "blocks must keep the allocations aligned");
+
+    static size_t align(size_t size)
+    {
+        return (size + HEADER_SIZE - 1) & ~(HEADER_SIZE - 1);
+    }
+
+    static void* allocate_heap(size_t size)
+    {
+        auto* header = static_cast<Header*>(std::malloc(HEADER_SIZE + size));
+        if (header == nullptr)
+            throw std::bad_alloc();
+        header->block = nullptr;
+        return reinterpret_cast<char*>(header) + HEADER_SIZE;
+    }
+
+    /// Hand block over to its values
+    /// @return true if there are none, the block is the caller's again
+    static bool retire(Block* block)
+    {
+        return block->state.fetch_or(RETIRED, std::memory_order_acq_rel) == 0;
+    }
+
+    size_t blockSize_;
+    std::vector<Block*> blocks_;
+    /// index of the block that is allocated from
+    size_t current_;
+};
+
+
+/// Stateless allocator for nlohmann::basic_json that allocates from the current JsonArena
+template <typename T>
+struct ArenaAllocator
+{
+    using value_type = T;
+
+    ArenaAllocator() noexcept = default;
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& /*other*/) noexcept
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        static_assert(alignof(T) <= 16, "arena allocations are 16 byte aligned");
+        return static_cast<T*>(JsonArena::allocate_current(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t /*n*/) noexcept
+    {
+        JsonArena::deallocate(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& /*lhs*/, const ArenaAllocator<U>& /*rhs*/)
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& /*lhs*/, const ArenaAllocator<U>& /*rhs*/)
+{
+    return false;
+}
+
+} // namespace jsonrpcpp
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef JSON_RPC_VIEW_HPP
+#define JSON_RPC_VIEW_HPP
+
+#include <boost/utility/string_view.hpp>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "jsonrpcpp.hpp"
+
+
+/// Zero-copy parse path for received JSON-RPC messages
+/// jsonrpcpp::Parser builds a Json DOM of the whole message and copies the subtrees into its entities.
+/// The MessageScanner instead walks the text once, classifies the message on the way and keeps its members
+/// as views into the text. Values are only parsed when they are used, e.g. the result of a response that
+/// belongs to a pending request. The scanner only checks the structure it walks, values are validated
+/// when they are parsed.
+namespace jsonrpcpp
+{
+
+namespace detail
+{
+
+inline const char* skip_ws(const char* p, const char* end)
+{
+    while ((p != end) && ((*p == ' ') || (*p == '\n') || (*p == '\r') || (*p == '\t')))
+        ++p;
+    return p;
+}
+
+/// @return the end of the string that starts at p, nullptr if it is not terminated
+inline const char* skip_string(const char* p, const char* end)
+{
+    ++p;
+    while (p != end)
+    {
+        const auto* quote = static_cast<const char*>(memchr(p, '"', end - p));
+        if (quote == nullptr)
+            return nullptr;
+        // the quote is escaped if it is preceded by an odd number of backslashes
+        size_t backslashes = 0;
+        while ((quote - backslashes > p) && (*(quote - backslashes - 1) == '\\'))
+            ++backslashes;
+        if (backslashes % 2 == 0)
+            return quote + 1;
+        p = quote + 1;
+    }
+    return nullptr;
+}
+
+/// @return the end of the value that starts at p, nullptr if it is not complete
+inline const char* skip_value(const char* p, const char* end)
+{
+    if (p == end)
+        return nullptr;
+    if (*p == '"')
+        return skip_string(p, end);
+    if ((*p == '{') || (*p == '['))
+    {
+        size_t depth = 0;
+        while (p != end)
+        {
+            char c = *p;
+            if (c == '"')
+            {
+                p = skip_string(p, end);
+                if (p == nullptr)
+                    return nullptr;
+                continue;
+            }
+            if ((c == '{') || (c == '['))
+                ++depth;
+            else if (((c == '}') || (c == ']')) && (--depth == 0))
+                return p + 1;
+            ++p;
+        }
+        return nullptr;
+    }
+    // number, true, false or null
+    const char* start = p;
+    while ((p != end) && (*p != ',') && (*p != '}') && (*p != ']') && (*p != ' ') && (*p != '\n') && (*p != '\r') && (*p != '\t'))
+        ++p;
+    return (p == start) ? nullptr : p;
+}
+
+/// Call fn(key, value) for the members of the object in text, until fn returns false
+/// The key is raw, escapes are not decoded.
+/// @return false if text is not an object
+template <typename F>
+bool for_each_member(boost::string_view text, F fn)
+{
+    const char* end = text.end();
+    const char* p = skip_ws(text.begin(), end);
+    if ((p == end) || (*p != '{'))
+        return false;
+    p = skip_ws(p + 1, end);
+    if ((p != end) && (*p == '}'))
+        return true;
+    while (true)
+    {
+        if ((p == end) || (*p != '"'))
+            return false;
+        const char* key_end = skip_string(p, end);
+        if (key_end == nullptr)
+            return false;
+        boost::string_view key(p + 1, key_end - p - 2);
+        p = skip_ws(key_end, end);
+        if ((p == end) || (*p != ':'))
+            return false;
+        p = skip_ws(p + 1, end);
+        const char* value_end = skip_value(p, end);
+        if (value_end == nullptr)
+            return false;
+        if (!fn(key, boost::string_view(p, value_end - p)))
+            return true;
+        p = skip_ws(value_end, end);
+        if ((p == end) || ((*p != ',') && (*p != '}')))
+            return false;
+        if (*p == '}')
+            return true;
+        p = skip_ws(p + 1, end);
+    }
+}
+
+/// Call fn(value) for the elements of the array in text, until fn returns false
+/// @return false if text is not an array
+template <typename F>
+bool for_each_element(boost::string_view text, F fn)
+{
+    const char* end = text.end();
+    const char* p = skip_ws(text.begin(), end);
+    if ((p == end) || (*p != '['))
+        return false;
+    p = skip_ws(p + 1, end);
+    if ((p != end) && (*p == ']'))
+        return true;
+    while (true)
+    {
+        const char* value_end = skip_value(p, end);
+        if (value_end == nullptr)
+            return false;
+        if (!fn(boost::string_view(p, value_end - p)))
+            return true;
+        p = skip_ws(value_end, end);
+        if ((p == end) || ((*p != ',') && (*p != ']')))
+            return false;
+        if (*p == ']')
+            return true;
+        p = skip_ws(p + 1, end);
+    }
+}
+
+/// Response whose result and error are moved in instead of copied
+class MovedResponse : public Response
+{
+public:
+    MovedResponse(Id id, Json result, Error error)
+    {
+        id_ = std::move(id);
+        result_ = std::move(result);
+        error_ = std::move(error);
+    }
+};
+
+} // namespace detail
+
+
+/// Raw JSON text of a value, e.g. the params of a message, only valid as long as the text is
+class JsonView
+{
+public:
+    JsonView() = default;
+    explicit JsonView(boost::string_view text) : text_(text)
+    {
+    }
+
+    /// @return the raw text, empty if the value is absent
+    boost::string_view text() const
+    {
+        return text_;
+    }
+
+    /// @return true if the value is absent
+    bool empty() const
+    {
+        return text_.empty();
+    }
+
+    bool is_null() const
+    {
+        return text_.empty() || (text_ == "null");
+    }
+
+    bool is_object() const
+    {
+        return !text_.empty() && (text_.front() == '{');
+    }
+
+    bool is_array() const
+    {
+        return !text_.empty() && (text_.front() == '[');
+    }
+
+    bool is_string() const
+    {
+        return !text_.empty() && (text_.front() == '"');
+    }
+
+    /// @return the member key of an object, empty if there is none
+    /// Only the members up to key are walked, none of them is parsed.
+    JsonView operator[](boost::string_view key) const
+    {
+        JsonView member;
+        detail::for_each_member(text_, [&member, key](boost::string_view name, boost::string_view value) {
+            if (name != key)
+                return true;
+            member = JsonView(value);
+            return false;
+        });
+        return member;
+    }
+
+    /// @return element idx of an array, empty if there is none
+    JsonView operator[](size_t idx) const
+    {
+        JsonView element;
+        size_t n = 0;
+        detail::for_each_element(text_, [&element, &n, idx](boost::string_view value) {
+            if (n++ != idx)
+                return true;
+            element = JsonView(value);
+            return false;
+        });
+        return element;
+    }
+
+    /// Parse the value into a DOM, throws Json::parse_error if it is malformed
+    Json json() const
+    {
+        if (text_.empty())
+            return nullptr;
+        return Json::parse(text_.begin(), text_.end());
+    }
+
+    template <typename T>
+    T get() const
+    {
+        return json().get<T>();
+    }
+
+    /// @return the unescaped string value, only strings with escapes go through the JSON parser
+    std::string str() const
+    {
+        if (!is_string() || (text_.size() < 2))
+            return json().get<std::string>();
+        boost::string_view raw = text_.substr(1, text_.size() - 2);
+        if (raw.find('\\') != boost::string_view::npos)
+            return json().get<std::string>();
+        return std::string(raw.data(), raw.size());
+    }
+
+    /// @return false if the value is not an integer that fits into an int
+    bool to_int(int& value) const
+    {
+        const char* p = text_.begin();
+        const char* end = text_.end();
+        bool negative = (p != end) && (*p == '-');
+        if (negative)
+            ++p;
+        if (p == end)
+            return false;
+        long long result = 0;
+        for (; p != end; ++p)
+        {
+            if ((*p < '0') || (*p > '9'))
+                return false;
+            result = 10 * result + (*p - '0');
+            if (result > 0x80000000LL)
+                return false;
+        }
+        result = negative ? -result : result;
+        if ((result > 0x7fffffffLL) || (result < -0x80000000LL))
+            return false;
+        value = static_cast<int>(result);
+        return true;
+    }
+
+private:
+    boost::string_view text_;
+};
+
+
+/// One JSON-RPC message, split into its members
+struct MessageView
+{
+    /// request, notification or response, unknown if the message is not valid JSON-RPC 2.0
+    Entity::entity_t type = Entity::entity_t::unknown;
+    /// raw method name, escapes are not decoded
+    boost::string_view method;
+    JsonView id;
+    JsonView params;
+    JsonView result;
+    JsonView error;
+
+    /// @return the id, throws RpcException if it isn't an integer, a string or null
+    Id to_id() const
+    {
+        int int_id;
+        if (id.to_int(int_id))
+            return Id(int_id);
+        if (id.is_null())
+            return Id();
+        try
+        {
+            return Id(id.json());
+        }
+        catch (const std::exception& e)
+        {
+            throw RpcException(e.what());
+        }
+    }
+
+    /// @return the response, only its result or error is parsed
+    /// Throws RpcException if the message is not a valid response
+    Response to_response() const
+    {
+        if (type != Entity::entity_t::response)
+            throw RpcException("not a response");
+        try
+        {
+            detail::MovedResponse response(to_id(), error.empty() ? result.json() : Json(nullptr), error.empty() ? Error(nullptr) : Error(error.json()));
+            return std::move(response);
+        }
+        catch (const RpcException&)
+        {
+            throw;
+        }
+        catch (const std::exception& e)
+        {
+            throw RpcException(e.what());
+        }
+    }
+};
+
+
+/// Splits received messages without building a DOM
+class MessageScanner
+{
+public:
+    /// Split text into its messages, a batch yields one message per member
+    /// messages is cleared first, so that its capacity can be reused from message to message
+    /// @return false if text is neither an object nor an array
+    static bool scan(boost::string_view text, std::vector<MessageView>& messages)
+    {
+        messages.clear();
+        const char* p = detail::skip_ws(text.begin(), text.end());
+        if ((p != text.end()) && (*p == '['))
+        {
+            return detail::for_each_element(text, [&messages](boost::string_view element) {
+                messages.emplace_back(classify(element));
+                return true;
+            });
+        }
+        MessageView message = classify(text);
+        if ((message.type == Entity::entity_t::unknown) && (p != text.end()) && (*p != '{'))
+            return false;
+        messages.push_back(message);
+        return true;
+    }
+
+    /// Split a single message into its members and classify it
+    static MessageView classify(boost::string_view text)
+    {
+        MessageView message;
+        bool version = false;
+        bool has_method = false;
+        bool valid = detail::for_each_member(text, [&](boost::string_view key, boost::string_view value) {
+            // the keys are matched by length first, every member is looked at once
+            switch (key.size())
+            {
+                case 2:
+                    if (key == "id")
+                        message.id = JsonView(value);
+                    break;
+                case 5:
+                    if (key == "error")
+                        message.error = JsonView(value);
+                    break;
+                case 6:
+                    if (key == "method")
+                    {
+                        has_method = (value.size() >= 2) && (value.front() == '"');
+                        if (has_method)
+                            message.method = value.substr(1, value.size() - 2);
+                    }
+                    else if (key == "params")
+                        message.params = JsonView(value);
+                    else if (key == "result")
+                        message.result = JsonView(value);
+                    break;
+                case 7:
+                    if (key == "jsonrpc")
+                        version = (value == "\"2.0\"");
+                    break;
+                default:
+                    break;
+            }
+            return true;
+        });
+
+        if (!valid || !version)
+            return message;
+        if (has_method && !message.method.empty())
+            message.type = message.id.empty() ? Entity::entity_t::notification : Entity::entity_t::request;
+        else if (!message.id.empty() && (!message.result.empty() || !message.error.empty()))
+            message.type = Entity::entity_t::response;
+        return message;
+    }
+};
+
+} // namespace jsonrpcpp
+
+#endif
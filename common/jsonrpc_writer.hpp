@@ -0,0 +1,372 @@
+#ifndef JSON_RPC_WRITER_HPP
+#define JSON_RPC_WRITER_HPP
+
+#include <boost/utility/string_view.hpp>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include "jsonrpcpp.hpp"
+
+
+namespace jsonrpcpp
+{
+
+/// Serializes JSON-RPC messages straight into an output buffer, without building a Json DOM first
+/// Messages are opened with request(), notification() or result(), which write the constant envelope in one
+/// go, and are closed with end_object(). Params and results are written with the key/value calls, Json values
+/// that already exist are serialized in place. The buffer is only appended to, so its capacity is reused if
+/// the caller clears it between messages.
+/// Strings are escaped but expected to be valid UTF-8, they are not validated like Json::dump does.
+class Writer
+{
+public:
+    explicit Writer(std::string& out) : out_(out), depth_(0), afterKey_(false)
+    {
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    /// Open a request, continue with key("params") or close it with end_object()
+    Writer& request(const Id& id, boost::string_view method)
+    {
+        open();
+        literal("{\"jsonrpc\":\"2.0\",\"method\":");
+        string(method);
+        literal(",\"id\":");
+        id_value(id);
+        return *this;
+    }
+
+    /// Open a notification, continue with key("params") or close it with end_object()
+    Writer& notification(boost::string_view method)
+    {
+        open();
+        literal("{\"jsonrpc\":\"2.0\",\"method\":");
+        string(method);
+        return *this;
+    }
+
+    /// Open a response, continue with the result value and close it with end_object()
+    Writer& result(const Id& id)
+    {
+        open();
+        literal("{\"jsonrpc\":\"2.0\",\"id\":");
+        id_value(id);
+        literal(",\"result\":");
+        afterKey_ = true;
+        return *this;
+    }
+
+    /// Write a complete request
+    Writer& request(const Id& id, boost::string_view method, const Parameter& params)
+    {
+        request(id, method);
+        if (!params.is_null())
+            key("params").value(params);
+        return end_object();
+    }
+
+    /// Write a complete notification
+    Writer& notification(boost::string_view method, const Parameter& params)
+    {
+        notification(method);
+        if (!params.is_null())
+            key("params").value(params);
+        return end_object();
+    }
+
+    /// Write a complete response
+    Writer& response(const Response& response)
+    {
+        if (!response.error())
+            return result(response.id()).value(response.result()).end_object();
+        open();
+        literal("{\"jsonrpc\":\"2.0\",\"id\":");
+        id_value(response.id());
+        literal(",\"error\":{\"code\":");
+        number(static_cast<int64_t>(response.error().code()));
+        literal(",\"message\":");
+        string(response.error().message());
+        if (!response.error().data().is_null())
+        {
+            literal(",\"data\":");
+            json(response.error().data());
+        }
+        literal("}}");
+        depth_ = 0;
+        return *this;
+    }
+
+    Writer& begin_object()
+    {
+        separator();
+        push();
+        out_.push_back('{');
+        return *this;
+    }
+
+    Writer& end_object()
+    {
+        out_.push_back('}');
+        --depth_;
+        return *this;
+    }
+
+    Writer& begin_array()
+    {
+        separator();
+        push();
+        out_.push_back('[');
+        return *this;
+    }
+
+    Writer& end_array()
+    {
+        out_.push_back(']');
+        --depth_;
+        return *this;
+    }
+
+    /// Write the key of an object member, followed by its value
+    Writer& key(boost::string_view name)
+    {
+        separator();
+        string(name);
+        out_.push_back(':');
+        afterKey_ = true;
+        return *this;
+    }
+
+    Writer& value(std::nullptr_t)
+    {
+        separator();
+        literal("null");
+        return *this;
+    }
+
+    Writer& value(bool b)
+    {
+        separator();
+        if (b)
+            literal("true");
+        else
+            literal("false");
+        return *this;
+    }
+
+    template <typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, int>::type = 0>
+    Writer& value(T n)
+    {
+        separator();
+        if (std::is_signed<T>::value)
+            number(static_cast<int64_t>(n));
+        else
+            number(static_cast<uint64_t>(n));
+        return *this;
+    }
+
+    template <typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+    Writer& value(T d)
+    {
+        separator();
+        if (!std::isfinite(d))
+        {
+            // like Json::dump
+            literal("null");
+            return *this;
+        }
+        char buffer[64];
+        char* end = nlohmann::detail::to_chars(buffer, buffer + sizeof(buffer), static_cast<double>(d));
+        out_.append(buffer, end - buffer);
+        return *this;
+    }
+
+    Writer& value(boost::string_view s)
+    {
+        separator();
+        string(s);
+        return *this;
+    }
+
+    Writer& value(const char* s)
+    {
+        return value(boost::string_view(s));
+    }
+
+    Writer& value(const std::string& s)
+    {
+        return value(boost::string_view(s));
+    }
+
+    /// Serialize an existing Json value in place
+    Writer& value(const Json& j)
+    {
+        separator();
+        json(j);
+        return *this;
+    }
+
+    /// Write params member by member, the Json values of the members are serialized in place
+    Writer& value(const Parameter& params)
+    {
+        if (params.is_map())
+        {
+            begin_object();
+            for (const auto& member : params.param_map)
+                key(member.first).value(member.second);
+            return end_object();
+        }
+        if (params.is_array())
+        {
+            begin_array();
+            for (const auto& element : params.param_array)
+                value(element);
+            return end_array();
+        }
+        return value(nullptr);
+    }
+
+private:
+    static constexpr size_t MAX_DEPTH = 64;
+
+    /// A message starts at the top level
+    void open()
+    {
+        depth_ = 0;
+        afterKey_ = false;
+        push();
+        first_[0] = false;
+    }
+
+    void push()
+    {
+        if (depth_ == MAX_DEPTH)
+            throw RpcException("Writer: nesting too deep");
+        first_[depth_++] = true;
+    }
+
+    /// Write the comma between two values
+    void separator()
+    {
+        if (afterKey_)
+        {
+            afterKey_ = false;
+            return;
+        }
+        if (depth_ == 0)
+            return;
+        if (!first_[depth_ - 1])
+            out_.push_back(',');
+        first_[depth_ - 1] = false;
+    }
+
+    /// Append a string literal, its length is known at compile time
+    template <size_t N>
+    void literal(const char (&s)[N])
+    {
+        out_.append(s, N - 1);
+    }
+
+    void id_value(const Id& id)
+    {
+        if (id.type() == Id::value_t::integer)
+            number(static_cast<int64_t>(id.int_id()));
+        else if (id.type() == Id::value_t::string)
+            string(id.string_id());
+        else
+            literal("null");
+    }
+
+    void number(uint64_t n)
+    {
+        char buffer[20];
+        char* p = buffer + sizeof(buffer);
+        do
+        {
+            *--p = static_cast<char>('0' + n % 10);
+            n /= 10;
+        } while (n != 0);
+        out_.append(p, buffer + sizeof(buffer) - p);
+    }
+
+    void number(int64_t n)
+    {
+        if (n < 0)
+        {
+            out_.push_back('-');
+            number(static_cast<uint64_t>(0) - static_cast<uint64_t>(n));
+        }
+        else
+            number(static_cast<uint64_t>(n));
+    }
+
+    /// Write s quoted and escaped, runs without special characters are appended in one go
+    void string(boost::string_view s)
+    {
+        static constexpr char HEX[] = "0123456789abcdef";
+        out_.push_back('"');
+        const char* run = s.begin();
+        for (const char* p = s.begin(); p != s.end(); ++p)
+        {
+            auto c = static_cast<unsigned char>(*p);
+            if ((c >= 0x20) && (c != '"') && (c != '\\'))
+                continue;
+            out_.append(run, p - run);
+            run = p + 1;
+            switch (c)
+            {
+                case '"':
+                    literal("\\\"");
+                    break;
+                case '\\':
+                    literal("\\\\");
+                    break;
+                case '\n':
+                    literal("\\n");
+                    break;
+                case '\r':
+                    literal("\\r");
+                    break;
+                case '\t':
+                    literal("\\t");
+                    break;
+                case '\b':
+                    literal("\\b");
+                    break;
+                case '\f':
+                    literal("\\f");
+                    break;
+                default:
+                {
+                    char escaped[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xf]};
+                    out_.append(escaped, 6);
+                }
+            }
+        }
+        out_.append(run, s.end() - run);
+        out_.push_back('"');
+    }
+
+    void json(const Json& j)
+    {
+        // the serializer allocates when it is created, it is kept for the next values
+        if (!serializer_)
+            serializer_.reset(new nlohmann::detail::serializer<Json>(nlohmann::detail::output_adapter<char>(out_), ' '));
+        serializer_->dump(j, false, false, 0);
+    }
+
+    std::string& out_;
+    size_t depth_;
+    bool afterKey_;
+    /// per nesting level: no value has been written yet
+    bool first_[MAX_DEPTH];
+    std::unique_ptr<nlohmann::detail::serializer<Json>> serializer_;
+};
+
+} // namespace jsonrpcpp
+
+#endif
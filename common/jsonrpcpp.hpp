@@ -29,7 +29,13 @@
 #include <vector>
 
 
+#ifdef JSONRPCPP_JSON_ARENA
+#include "json_arena.hpp"
+/// DOM nodes are allocated from the thread's current JsonArena, if there is one
+using Json = nlohmann::basic_json<std::map, std::vector, std::string, bool, std::int64_t, std::uint64_t, double, jsonrpcpp::ArenaAllocator>;
+#else
 using Json = nlohmann::json;
+#endif
 
 namespace jsonrpcpp
 {
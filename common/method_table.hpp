@@ -0,0 +1,203 @@
+#ifndef METHOD_TABLE_HPP
+#define METHOD_TABLE_HPP
+
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "jsonrpc_view.hpp"
+
+
+namespace jsonrpcpp
+{
+
+/// Dispatches received notifications and requests to handlers by method name
+/// The method names are interned at registration into a flat, open addressing hash table, a lookup hashes the
+/// raw method token of the MessageView and usually compares a single entry, no std::string is created.
+/// Typed handlers get their params decoded into a struct by nlohmann's from_json for that struct.
+class MethodTable
+{
+public:
+    using NotificationHandler = std::function<void(const MessageView& notification)>;
+    /// @return the result, throw a RequestException (e.g. InvalidParamsException) to answer with an error
+    using RequestHandler = std::function<Json(const MessageView& request)>;
+
+    MethodTable() : slots_(16, EMPTY)
+    {
+    }
+
+    /// Register a handler for notification method, an existing one is replaced
+    void on_notification(const std::string& method, NotificationHandler handler)
+    {
+        entry(method).notification = std::move(handler);
+    }
+
+    /// Register a handler that gets the params decoded into Params
+    /// A notification whose params can't be decoded throws RpcException from notify()
+    template <typename Params>
+    void on_notification(const std::string& method, std::function<void(const Params& params)> handler)
+    {
+        on_notification(method, [handler](const MessageView& notification) { handler(decode<Params>(notification)); });
+    }
+
+    /// Register a handler for request method, an existing one is replaced
+    void on_request(const std::string& method, RequestHandler handler)
+    {
+        entry(method).request = std::move(handler);
+    }
+
+    /// Register a handler that gets the params decoded into Params
+    /// A request whose params can't be decoded is answered with an invalid params error
+    template <typename Params>
+    void on_request(const std::string& method, std::function<Json(const Params& params)> handler)
+    {
+        on_request(method, [handler](const MessageView& request) { return handler(decode<Params>(request)); });
+    }
+
+    /// Call the handler of a notification
+    /// @return false if there is no handler for its method
+    bool notify(const MessageView& notification) const
+    {
+        const Entry* found = find(notification.method);
+        if ((found == nullptr) || !found->notification)
+            return false;
+        found->notification(notification);
+        return true;
+    }
+
+    /// @return true if there is a request handler for method
+    bool has_request(boost::string_view method) const
+    {
+        const Entry* found = find(method);
+        return (found != nullptr) && found->request;
+    }
+
+    /// Call the handler of a request
+    /// @return the response, method not found if there is no handler
+    Response call(const MessageView& request) const
+    {
+        Id id;
+        try
+        {
+            id = request.to_id();
+        }
+        catch (const std::exception& e)
+        {
+            return Response(InvalidRequestException(e.what()));
+        }
+        const Entry* found = find(request.method);
+        if ((found == nullptr) || !found->request)
+            return Response(MethodNotFoundException(std::string(request.method.data(), request.method.size()), id));
+        try
+        {
+            return Response(id, found->request(request));
+        }
+        catch (const RequestException& e)
+        {
+            return Response(id, e.error());
+        }
+        catch (const std::exception& e)
+        {
+            return Response(InternalErrorException(e.what(), id));
+        }
+    }
+
+    size_t size() const
+    {
+        return entries_.size();
+    }
+
+private:
+    enum : int32_t
+    {
+        EMPTY = -1
+    };
+
+    struct Entry
+    {
+        uint32_t hash;
+        std::string method;
+        NotificationHandler notification;
+        RequestHandler request;
+    };
+
+    template <typename Params>
+    static Params decode(const MessageView& message)
+    {
+        try
+        {
+            return message.params.json().get<Params>();
+        }
+        catch (const std::exception& e)
+        {
+            throw InvalidParamsException(e.what(), message.id.empty() ? Id() : message.to_id());
+        }
+    }
+
+    /// 32 bit FNV-1a
+    static uint32_t hash(boost::string_view method)
+    {
+        uint32_t h = 2166136261u;
+        for (char c : method)
+        {
+            h ^= static_cast<uint8_t>(c);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    const Entry* find(boost::string_view method) const
+    {
+        uint32_t h = hash(method);
+        size_t mask = slots_.size() - 1;
+        for (size_t n = h & mask; slots_[n] != EMPTY; n = (n + 1) & mask)
+        {
+            const Entry& candidate = entries_[slots_[n]];
+            if ((candidate.hash == h) && (candidate.method.size() == method.size()) && (memcmp(candidate.method.data(), method.data(), method.size()) == 0))
+                return &candidate;
+        }
+        return nullptr;
+    }
+
+    /// @return the entry of method, created if there is none
+    Entry& entry(const std::string& method)
+    {
+        const Entry* found = find(method);
+        if (found != nullptr)
+            return entries_[found - entries_.data()];
+        // keep the load below 1/2, so that a lookup rarely probes more than one slot
+        if (2 * (entries_.size() + 1) > slots_.size())
+            rehash(2 * slots_.size());
+        uint32_t h = hash(method);
+        entries_.push_back(Entry{h, method, nullptr, nullptr});
+        insert(h, static_cast<int32_t>(entries_.size() - 1));
+        return entries_.back();
+    }
+
+    void insert(uint32_t h, int32_t index)
+    {
+        size_t mask = slots_.size() - 1;
+        size_t n = h & mask;
+        while (slots_[n] != EMPTY)
+            n = (n + 1) & mask;
+        slots_[n] = index;
+    }
+
+    void rehash(size_t capacity)
+    {
+        slots_.assign(capacity, EMPTY);
+        for (size_t n = 0; n < entries_.size(); ++n)
+            insert(entries_[n].hash, static_cast<int32_t>(n));
+    }
+
+    std::vector<Entry> entries_;
+    /// indices into entries_, EMPTY for free slots
+    std::vector<int32_t> slots_;
+};
+
+} // namespace jsonrpcpp
+
+#endif
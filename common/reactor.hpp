@@ -0,0 +1,216 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <set>
+#include <utility>
+
+#include "common/snap_exception.hpp"
+
+
+/// Dispatches readiness of file descriptors and expired deadlines to handlers
+/// Handlers may add and remove file descriptors and timers while events are dispatched.
+class Reactor
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    /// called with the epoll events (EPOLLIN, EPOLLOUT, EPOLLERR, ...) that are pending on the fd
+    using Handler = std::function<void(uint32_t events)>;
+    using TimerHandler = std::function<void()>;
+
+    virtual ~Reactor() = default;
+
+    /// Watch fd for events, a previous registration of fd is replaced
+    virtual void add(int fd, Handler handler, uint32_t events = EPOLLIN) = 0;
+    /// Change the events that fd is watched for
+    virtual void modify(int fd, uint32_t events) = 0;
+    /// Stop watching fd, must be called before fd is closed
+    virtual void remove(int fd) = 0;
+    /// Call handler once deadline is reached
+    /// @return id to cancel the timer with
+    virtual size_t addTimer(const Clock::time_point& deadline, TimerHandler handler) = 0;
+    /// Cancel a timer, ids of expired or cancelled timers are ignored
+    virtual void cancelTimer(size_t id) = 0;
+};
+
+
+/// epoll based reactor that waits on any number of file descriptors and deadlines in one call
+/// Unlike select it is not limited to FD_SETSIZE and the interest set doesn't have to be rebuilt for every wait.
+/// All methods except wakeup() must be called from the thread that runs the reactor.
+class EpollReactor : public Reactor
+{
+public:
+    EpollReactor() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)), wakeup_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), next_generation_(1), next_timer_id_(1)
+    {
+        if ((epoll_fd_ < 0) || (wakeup_fd_ < 0))
+            throw SnapException("Reactor - Failed to create epoll instance: " + std::string(strerror(errno)));
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = key(wakeup_fd_, 0);
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event) != 0)
+            throw SnapException("Reactor - Failed to watch wakeup fd: " + std::string(strerror(errno)));
+    }
+
+    ~EpollReactor() override
+    {
+        close(wakeup_fd_);
+        close(epoll_fd_);
+    }
+
+    EpollReactor(const EpollReactor&) = delete;
+    EpollReactor& operator=(const EpollReactor&) = delete;
+
+    void add(int fd, Handler handler, uint32_t events = EPOLLIN) override
+    {
+        uint32_t generation = next_generation_++;
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = key(fd, generation);
+        bool known = (fds_.find(fd) != fds_.end());
+        int res = epoll_ctl(epoll_fd_, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+        // a registered fd that has been closed without remove() is no longer known to epoll
+        if ((res != 0) && known && (errno == ENOENT))
+            res = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+        if (res != 0)
+            throw SnapException("Reactor - Failed to watch fd " + std::to_string(fd) + ": " + std::string(strerror(errno)));
+        fds_[fd] = Registration{generation, std::move(handler)};
+    }
+
+    void modify(int fd, uint32_t events) override
+    {
+        auto it = fds_.find(fd);
+        if (it == fds_.end())
+            return;
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = key(fd, it->second.generation);
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) != 0)
+            throw SnapException("Reactor - Failed to modify fd " + std::to_string(fd) + ": " + std::string(strerror(errno)));
+    }
+
+    void remove(int fd) override
+    {
+        if (fds_.erase(fd) == 0)
+            return;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    size_t addTimer(const Clock::time_point& deadline, TimerHandler handler) override
+    {
+        size_t id = next_timer_id_++;
+        deadlines_.emplace(deadline, id);
+        timers_[id] = Timer{deadline, std::move(handler)};
+        return id;
+    }
+
+    void cancelTimer(size_t id) override
+    {
+        auto it = timers_.find(id);
+        if (it == timers_.end())
+            return;
+        deadlines_.erase(std::make_pair(it->second.deadline, id));
+        timers_.erase(it);
+    }
+
+    /// Interrupt a running runOnce, may be called from any thread
+    void wakeup()
+    {
+        uint64_t one = 1;
+        if (write(wakeup_fd_, &one, sizeof(one)) != sizeof(one))
+            return;
+    }
+
+    /// Wait until an fd is ready, a timer expires, wakeup() is called or until is reached, and dispatch
+    /// @return false if the wait was interrupted by wakeup()
+    bool runOnce(const Clock::time_point& until = Clock::time_point::max())
+    {
+        auto wait_until = until;
+        if (!deadlines_.empty())
+            wait_until = std::min(wait_until, deadlines_.begin()->first);
+
+        int timeout_ms = -1;
+        if (wait_until != Clock::time_point::max())
+        {
+            auto wait = std::chrono::duration_cast<std::chrono::microseconds>(wait_until - Clock::now()).count();
+            // round up, so that the deadline has passed when epoll_wait returns
+            timeout_ms = (wait <= 0) ? 0 : static_cast<int>(std::min<long long>((wait + 999) / 1000, 24 * 3600 * 1000));
+        }
+
+        epoll_event events[MAX_EVENTS];
+        int ready = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout_ms);
+        if ((ready < 0) && (errno != EINTR))
+            throw SnapException("Reactor - epoll_wait failed: " + std::string(strerror(errno)));
+
+        bool woken = false;
+        for (int n = 0; n < ready; ++n)
+        {
+            int fd = static_cast<int>(events[n].data.u64 & 0xffffffff);
+            auto generation = static_cast<uint32_t>(events[n].data.u64 >> 32);
+            if (fd == wakeup_fd_)
+            {
+                uint64_t count;
+                while (read(wakeup_fd_, &count, sizeof(count)) == sizeof(count))
+                    ;
+                woken = true;
+                continue;
+            }
+            // skip fds that have been removed or replaced by an earlier handler
+            auto it = fds_.find(fd);
+            if ((it == fds_.end()) || (it->second.generation != generation))
+                continue;
+            Handler handler = it->second.handler;
+            handler(events[n].events);
+        }
+
+        auto now = Clock::now();
+        while (!deadlines_.empty() && (deadlines_.begin()->first <= now))
+        {
+            size_t id = deadlines_.begin()->second;
+            deadlines_.erase(deadlines_.begin());
+            auto it = timers_.find(id);
+            TimerHandler handler = std::move(it->second.handler);
+            timers_.erase(it);
+            handler();
+        }
+        return !woken;
+    }
+
+private:
+    static constexpr int MAX_EVENTS = 64;
+
+    struct Registration
+    {
+        uint32_t generation;
+        Handler handler;
+    };
+
+    struct Timer
+    {
+        Clock::time_point deadline;
+        TimerHandler handler;
+    };
+
+    static uint64_t key(int fd, uint32_t generation)
+    {
+        return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    int epoll_fd_;
+    int wakeup_fd_;
+    uint32_t next_generation_;
+    size_t next_timer_id_;
+    std::map<int, Registration> fds_;
+    std::set<std::pair<Clock::time_point, size_t>> deadlines_;
+    std::map<size_t, Timer> timers_;
+};
+
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+
+/// Growable byte ring buffer for stream reassembly
+/// The capacity is a power of two, so wrapping is a mask. Data is appended into the (up to two) free regions
+/// returned by prepare() and consumed from the front. The buffer only allocates when it has to grow.
+class RingBuffer
+{
+public:
+    /// a contiguous region of the buffer
+    using Region = std::pair<char*, size_t>;
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    explicit RingBuffer(size_t capacity = 4096) : capacity_(roundUp(capacity)), data_(new char[capacity_]), head_(0), size_(0)
+    {
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    /// @return the free space as up to two regions with at least minFree bytes in total, grows the buffer if needed
+    std::array<Region, 2> prepare(size_t minFree)
+    {
+        if (capacity_ - size_ < minFree)
+            grow(size_ + minFree);
+        size_t tail = (head_ + size_) & (capacity_ - 1);
+        size_t free = capacity_ - size_;
+        size_t first = std::min(free, capacity_ - tail);
+        return {{Region(data_.get() + tail, first), Region(data_.get(), free - first)}};
+    }
+
+    /// Append n bytes that have been written into the regions returned by prepare()
+    void commit(size_t n)
+    {
+        size_ += std::min(n, capacity_ - size_);
+    }
+
+    /// Remove n bytes from the front
+    void consume(size_t n)
+    {
+        n = std::min(n, size_);
+        head_ = (head_ + n) & (capacity_ - 1);
+        size_ -= n;
+        // keep the data at the start of the buffer, so that short frames rarely wrap
+        if (size_ == 0)
+            head_ = 0;
+    }
+
+    /// @return position of the first c at or after from, npos if there is none
+    size_t find(char c, size_t from = 0) const
+    {
+        if (from >= size_)
+            return npos;
+        size_t start = (head_ + from) & (capacity_ - 1);
+        size_t first = std::min(size_ - from, capacity_ - start);
+        auto found = static_cast<const char*>(memchr(data_.get() + start, c, first));
+        if (found != nullptr)
+            return from + (found - (data_.get() + start));
+        found = static_cast<const char*>(memchr(data_.get(), c, size_ - from - first));
+        if (found != nullptr)
+            return from + first + (found - data_.get());
+        return npos;
+    }
+
+    /// @return pointer to the first n bytes if they are contiguous, nullptr if they wrap
+    const char* contiguous(size_t n) const
+    {
+        return (head_ + n <= capacity_) ? data_.get() + head_ : nullptr;
+    }
+
+    /// Copy n bytes starting at pos into dst
+    void copy(size_t pos, size_t n, char* dst) const
+    {
+        size_t start = (head_ + pos) & (capacity_ - 1);
+        size_t first = std::min(n, capacity_ - start);
+        memcpy(dst, data_.get() + start, first);
+        memcpy(dst + first, data_.get(), n - first);
+    }
+
+private:
+    static size_t roundUp(size_t n)
+    {
+        size_t capacity = 64;
+        while (capacity < n)
+            capacity *= 2;
+        return capacity;
+    }
+
+    void grow(size_t required)
+    {
+        size_t capacity = roundUp(required);
+        std::unique_ptr<char[]> data(new char[capacity]);
+        copy(0, size_, data.get());
+        data_ = std::move(data);
+        capacity_ = capacity;
+        head_ = 0;
+    }
+
+    size_t capacity_;
+    std::unique_ptr<char[]> data_;
+    size_t head_;
+    size_t size_;
+};
+
+
+#endif
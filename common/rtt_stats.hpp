@@ -0,0 +1,93 @@
+#ifndef RTT_STATS_HPP
+#define RTT_STATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+
+/// Round trip times over a sliding window of the last WINDOW samples
+/// Jitter is smoothed like the interarrival jitter of RFC 3550: J += (|D| - J) / 16
+class RttStats
+{
+public:
+    static constexpr size_t WINDOW = 64;
+
+    RttStats() : next_(0), count_(0), last_(0), jitter_(0)
+    {
+    }
+
+    void add(std::chrono::microseconds rtt)
+    {
+        auto sample = static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(rtt.count(), 0), UINT32_MAX));
+        if (count_ > 0)
+            jitter_ += (std::abs(static_cast<double>(sample) - static_cast<double>(last_)) - jitter_) / 16.;
+        last_ = sample;
+        samples_[next_] = sample;
+        next_ = (next_ + 1) % WINDOW;
+        if (count_ < WINDOW)
+            ++count_;
+    }
+
+    /// @return the number of samples in the window
+    size_t count() const
+    {
+        return count_;
+    }
+
+    bool empty() const
+    {
+        return count_ == 0;
+    }
+
+    std::chrono::microseconds last() const
+    {
+        return std::chrono::microseconds(last_);
+    }
+
+    std::chrono::microseconds min() const
+    {
+        if (count_ == 0)
+            return std::chrono::microseconds(0);
+        return std::chrono::microseconds(*std::min_element(samples_.begin(), samples_.begin() + count_));
+    }
+
+    std::chrono::microseconds avg() const
+    {
+        if (count_ == 0)
+            return std::chrono::microseconds(0);
+        uint64_t sum = 0;
+        for (size_t n = 0; n < count_; ++n)
+            sum += samples_[n];
+        return std::chrono::microseconds(sum / count_);
+    }
+
+    std::chrono::microseconds p99() const
+    {
+        if (count_ == 0)
+            return std::chrono::microseconds(0);
+        std::array<uint32_t, WINDOW> sorted;
+        std::copy(samples_.begin(), samples_.begin() + count_, sorted.begin());
+        size_t rank = (count_ * 99 + 99) / 100 - 1;
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.begin() + count_);
+        return std::chrono::microseconds(sorted[rank]);
+    }
+
+    std::chrono::microseconds jitter() const
+    {
+        return std::chrono::microseconds(static_cast<int64_t>(jitter_));
+    }
+
+private:
+    std::array<uint32_t, WINDOW> samples_;
+    /// index of the slot the next sample goes to
+    size_t next_;
+    size_t count_;
+    uint32_t last_;
+    double jitter_;
+};
+
+
+#endif
@@ -8,13 +8,56 @@ struct Settings {
     struct Server
     {
         std::string host{""};
+        /// used if discovery doesn't report a port
         size_t port{1705};
+        /// deadline of a single connect attempt
+        size_t connect_timeout_ms{3000};
+        /// max number of connect attempts in flight at the same time
+        size_t max_connect_attempts{2};
+        /// bounds of the jittered exponential backoff between reconnects
+        size_t reconnect_min_ms{500};
+        size_t reconnect_max_ms{30000};
+        /// default deadline of a JSON-RPC request
+        size_t request_timeout_ms{5000};
+        /// JSON-RPC messages issued within this window are sent as one batch, 0 for the same event loop tick
+        size_t batch_window_us{0};
+        /// max size of a batch, 0 to disable batching
+        size_t batch_bytes{64 * 1024};
+        /// the connection is congested, and telemetry is dropped, once this many bytes wait for sending
+        size_t write_high_watermark{1024 * 1024};
+        /// until it has drained to this many bytes
+        size_t write_low_watermark{64 * 1024};
+        /// a server that lets more bytes pile up is considered stalled and the connection is dropped
+        size_t write_limit{16 * 1024 * 1024};
+        /// time between two application level pings, 0 to disable the heartbeat
+        size_t heartbeat_interval_ms{5000};
+        /// the server is considered dead after this many unanswered pings in a row
+        size_t heartbeat_max_missed{3};
+        /// JSON-RPC method of the ping, any response including an error counts as alive
+        std::string heartbeat_method{"Client.Ping"};
+        /// TCP keepalive, idle time before the first probe in s, 0 to disable
+        size_t tcp_keepalive_idle_s{15};
+        size_t tcp_keepalive_interval_s{5};
+        size_t tcp_keepalive_count{3};
+        /// "line" (newline delimited JSON-RPC) or "binary", binary is negotiated and falls back to line
+        std::string framing{"line"};
+    };
+
+    struct Discovery
+    {
+        /// "bonjour", "avahi" or "auto"
+        std::string engine{"auto"};
+        /// resolved endpoints are persisted here for a warm start, empty to disable
+        std::string cache_file{"/var/cache/spr_client/mdns_cache.json"};
+        /// interfaces to browse on in parallel, empty for every interface that is up
+        std::vector<std::string> interfaces;
     };
 
     size_t instance{1};
     std::string host_id;
 
     Server server;
+    Discovery discovery;
 };
 
 #endif
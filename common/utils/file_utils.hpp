@@ -24,6 +24,8 @@
 #ifndef WINDOWS
 #include <grp.h>
 #include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 #include <stdexcept>
 #include <vector>
@@ -0,0 +1,179 @@
+#ifndef WRITE_QUEUE_HPP
+#define WRITE_QUEUE_HPP
+
+#include <boost/asio/buffer.hpp>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/// Outgoing bytes of a connection, written with one gathering write (writev) per batch of segments
+/// Small writes are merged into chunks, large buffers are referenced instead of copied. Chunks are recycled
+/// once they have been written, so the queue doesn't allocate in steady state.
+/// Segments that are being written are left alone, new data goes into segments behind them.
+class WriteQueue
+{
+public:
+    /// a buffer that may be shared with other queues
+    using Buffer = std::shared_ptr<const std::string>;
+
+    /// The buffer sequence of one write, cheap to copy unlike a vector
+    struct Buffers
+    {
+        const boost::asio::const_buffer* first;
+        const boost::asio::const_buffer* last;
+
+        const boost::asio::const_buffer* begin() const
+        {
+            return first;
+        }
+
+        const boost::asio::const_buffer* end() const
+        {
+            return last;
+        }
+    };
+
+    /// buffers up to this size are copied into a chunk
+    static constexpr size_t MERGE_SIZE = 1024;
+    /// a chunk takes small writes until it is this large
+    static constexpr size_t CHUNK_SIZE = 16 * 1024;
+    /// max number of segments per write, well below IOV_MAX
+    static constexpr size_t MAX_SEGMENTS = 64;
+
+    WriteQueue() : bytes_(0), writing_(0)
+    {
+    }
+
+    /// Append a copy of data
+    void write(const char* data, size_t size)
+    {
+        if (size == 0)
+            return;
+        std::string& chunk = tail();
+        chunk.append(data, size);
+        bytes_ += size;
+    }
+
+    /// Append buffer, small buffers are copied, large ones are referenced
+    void write(Buffer buffer)
+    {
+        if (buffer->size() <= MERGE_SIZE)
+        {
+            write(buffer->data(), buffer->size());
+            return;
+        }
+        bytes_ += buffer->size();
+        segments_.emplace_back();
+        segments_.back().shared = std::move(buffer);
+    }
+
+    /// @return the number of queued bytes, including the ones that are being written
+    size_t size() const
+    {
+        return bytes_;
+    }
+
+    bool empty() const
+    {
+        return bytes_ == 0;
+    }
+
+    /// @return true between prepare() and consume()
+    bool writing() const
+    {
+        return writing_ != 0;
+    }
+
+    /// Collect the segments for the next write, they are not modified until consume()
+    Buffers prepare()
+    {
+        buffers_.clear();
+        writing_ = (segments_.size() < MAX_SEGMENTS) ? segments_.size() : MAX_SEGMENTS;
+        for (size_t n = 0; n < writing_; ++n)
+        {
+            const Segment& segment = segments_[n];
+            const std::string& data = segment.shared ? *segment.shared : segment.chunk;
+            buffers_.emplace_back(data.data(), data.size());
+        }
+        return Buffers{buffers_.data(), buffers_.data() + buffers_.size()};
+    }
+
+    /// The segments of the last prepare() have been written
+    void consume()
+    {
+        for (size_t n = 0; n < writing_; ++n)
+        {
+            Segment& segment = segments_.front();
+            if (segment.shared)
+                bytes_ -= segment.shared->size();
+            else
+            {
+                bytes_ -= segment.chunk.size();
+                recycle(std::move(segment.chunk));
+            }
+            segments_.pop_front();
+        }
+        writing_ = 0;
+    }
+
+    void clear()
+    {
+        segments_.clear();
+        buffers_.clear();
+        bytes_ = 0;
+        writing_ = 0;
+    }
+
+private:
+    static constexpr size_t MAX_SPARE = 8;
+
+    struct Segment
+    {
+        /// either a referenced buffer or an owned chunk
+        Buffer shared;
+        std::string chunk;
+    };
+
+    /// @return the chunk that small writes go to
+    std::string& tail()
+    {
+        if (segments_.size() > writing_)
+        {
+            Segment& last = segments_.back();
+            if (!last.shared && (last.chunk.size() < CHUNK_SIZE))
+                return last.chunk;
+        }
+        segments_.emplace_back();
+        std::string& chunk = segments_.back().chunk;
+        if (!spare_.empty())
+        {
+            chunk = std::move(spare_.back());
+            spare_.pop_back();
+        }
+        else
+            chunk.reserve(CHUNK_SIZE);
+        return chunk;
+    }
+
+    void recycle(std::string chunk)
+    {
+        if ((spare_.size() == MAX_SPARE) || (chunk.capacity() > 4 * CHUNK_SIZE))
+            return;
+        chunk.clear();
+        spare_.push_back(std::move(chunk));
+    }
+
+    std::deque<Segment> segments_;
+    /// the chunks of written segments, kept for their capacity
+    std::vector<std::string> spare_;
+    std::vector<boost::asio::const_buffer> buffers_;
+    size_t bytes_;
+    /// number of segments at the front that are being written
+    size_t writing_;
+};
+
+
+#endif
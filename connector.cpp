@@ -0,0 +1,159 @@
+#include "connector.h"
+
+#include <algorithm>
+
+#include "common/aixlog.hpp"
+
+using namespace std;
+using boost::asio::ip::tcp;
+
+static constexpr auto LOG_TAG = "Connector";
+
+constexpr std::chrono::milliseconds Connector::CONNECTION_ATTEMPT_DELAY;
+
+
+Connector::Connector(boost::asio::io_context& io, const std::vector<tcp::endpoint>& endpoints, std::chrono::milliseconds attemptTimeout,
+                     size_t maxConcurrent)
+    : strand_(boost::asio::make_strand(io)), endpoints_(interleave(endpoints)), attemptTimeout_(attemptTimeout),
+      maxConcurrent_(std::max<size_t>(maxConcurrent, 1)), next_(0), delay_(strand_), done_(false)
+{
+}
+
+
+size_t Connector::pending() const
+{
+    return std::count_if(attempts_.begin(), attempts_.end(), [](const std::unique_ptr<Attempt>& attempt) { return attempt->pending; });
+}
+
+
+std::vector<tcp::endpoint> Connector::interleave(const std::vector<tcp::endpoint>& endpoints)
+{
+    std::vector<tcp::endpoint> v6;
+    std::vector<tcp::endpoint> v4;
+    for (const auto& endpoint : endpoints)
+    {
+        auto& family = endpoint.address().is_v6() ? v6 : v4;
+        if (std::find(family.begin(), family.end(), endpoint) == family.end())
+            family.push_back(endpoint);
+    }
+
+    std::vector<tcp::endpoint> result;
+    for (size_t n = 0; n < std::max(v6.size(), v4.size()); ++n)
+    {
+        if (n < v6.size())
+            result.push_back(v6[n]);
+        if (n < v4.size())
+            result.push_back(v4[n]);
+    }
+    return result;
+}
+
+
+void Connector::start(Handler handler)
+{
+    handler_ = std::move(handler);
+    auto self = shared_from_this();
+    boost::asio::post(strand_, [self] {
+        if (self->endpoints_.empty())
+            self->finish(boost::asio::error::host_not_found, 0);
+        else
+            self->startNext();
+    });
+}
+
+
+void Connector::cancel()
+{
+    auto self = shared_from_this();
+    boost::asio::post(strand_, [self] { self->finish(boost::asio::error::operation_aborted, self->attempts_.size()); });
+}
+
+
+void Connector::startNext()
+{
+    // the next attempt is started once a running one fails
+    if (done_ || (next_ >= endpoints_.size()) || (pending() >= maxConcurrent_))
+        return;
+
+    size_t index = attempts_.size();
+    const tcp::endpoint& endpoint = endpoints_[next_++];
+    LOG(INFO, LOG_TAG) << "Connecting to " << endpoint << endl;
+    attempts_.emplace_back(new Attempt(strand_, endpoint));
+    Attempt& attempt = *attempts_.back();
+    auto self = shared_from_this();
+    // the socket's executor is the strand, so are its completion handlers
+    attempt.socket.async_connect(endpoint, [self, index](const boost::system::error_code& ec) { self->onConnect(index, ec); });
+    attempt.deadline.expires_after(attemptTimeout_);
+    attempt.deadline.async_wait([self, index](const boost::system::error_code& ec) {
+        Attempt& attempt = *self->attempts_[index];
+        if (ec || !attempt.pending)
+            return;
+        // closing the socket completes the connect with operation_aborted
+        attempt.timedOut = true;
+        boost::system::error_code ignored;
+        attempt.socket.close(ignored);
+    });
+
+    if (next_ < endpoints_.size())
+    {
+        delay_.expires_after(CONNECTION_ATTEMPT_DELAY);
+        delay_.async_wait([self](const boost::system::error_code& ec) {
+            if (!ec)
+                self->startNext();
+        });
+    }
+}
+
+
+void Connector::onConnect(size_t index, const boost::system::error_code& error)
+{
+    Attempt& attempt = *attempts_[index];
+    attempt.pending = false;
+    attempt.deadline.cancel();
+    if (done_)
+        return;
+
+    auto ec = (attempt.timedOut && (error == boost::asio::error::operation_aborted)) ? boost::system::error_code(boost::asio::error::timed_out) : error;
+    if (!ec)
+    {
+        LOG(INFO, LOG_TAG) << "Connected to " << attempt.endpoint << endl;
+        finish(ec, index);
+        return;
+    }
+
+    LOG(WARNING, LOG_TAG) << "Failed to connect to " << attempt.endpoint << ": " << ec.message() << endl;
+    lastError_ = ec;
+    // a failed attempt doesn't wait for the attempt delay
+    if (next_ < endpoints_.size())
+    {
+        delay_.cancel();
+        startNext();
+        return;
+    }
+    if (pending() == 0)
+        finish(lastError_, attempts_.size());
+}
+
+
+void Connector::finish(const boost::system::error_code& ec, size_t winner)
+{
+    if (done_)
+        return;
+    done_ = true;
+    delay_.cancel();
+    for (size_t n = 0; n < attempts_.size(); ++n)
+    {
+        attempts_[n]->deadline.cancel();
+        if (n == winner)
+            continue;
+        boost::system::error_code ignored;
+        attempts_[n]->socket.close(ignored);
+    }
+
+    Handler handler = std::move(handler_);
+    handler_ = nullptr;
+    if (winner < attempts_.size())
+        handler(ec, std::move(attempts_[winner]->socket));
+    else
+        handler(ec, tcp::socket(strand_));
+}
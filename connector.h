@@ -0,0 +1,71 @@
+#ifndef __Connector_H_
+#define __Connector_H_
+#include <boost/asio.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/// Races TCP connects to the endpoints of one server, RFC 8305 ("Happy Eyeballs v2") style
+/// The endpoints are tried in interleaved family order, starting with IPv6. The next attempt starts as soon as
+/// the previous one failed or after CONNECTION_ATTEMPT_DELAY, the first established connection wins and all
+/// other attempts are cancelled. Every attempt has its own deadline and only maxConcurrent attempts are in
+/// flight at the same time, so an unreachable address never blocks for the kernel's SYN timeout.
+class Connector : public std::enable_shared_from_this<Connector>
+{
+public:
+    /// Called once, with the connected socket or with the error of the last attempt
+    using Handler = std::function<void(const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket)>;
+
+    /// RFC 8305 recommends 250 ms between two connection attempts
+    static constexpr std::chrono::milliseconds CONNECTION_ATTEMPT_DELAY{250};
+
+    /// c'tor
+    /// @param attemptTimeout deadline of a single connect attempt, it fails with timed_out
+    /// @param maxConcurrent max number of attempts in flight, at least 1
+    Connector(boost::asio::io_context& io, const std::vector<boost::asio::ip::tcp::endpoint>& endpoints,
+              std::chrono::milliseconds attemptTimeout = std::chrono::milliseconds(3000), size_t maxConcurrent = 2);
+
+    void start(Handler handler);
+    /// Cancel all outstanding attempts, the handler is called with operation_aborted
+    void cancel();
+
+    /// @return endpoints without duplicates, interleaved by address family starting with IPv6 (RFC 8305, section 4)
+    static std::vector<boost::asio::ip::tcp::endpoint> interleave(const std::vector<boost::asio::ip::tcp::endpoint>& endpoints);
+
+private:
+    struct Attempt
+    {
+        Attempt(boost::asio::strand<boost::asio::io_context::executor_type>& strand, const boost::asio::ip::tcp::endpoint& endpoint)
+            : socket(strand), endpoint(endpoint), deadline(strand), pending(true), timedOut(false)
+        {
+        }
+
+        boost::asio::ip::tcp::socket socket;
+        boost::asio::ip::tcp::endpoint endpoint;
+        boost::asio::steady_timer deadline;
+        bool pending;
+        bool timedOut;
+    };
+
+    size_t pending() const;
+
+    void startNext();
+    void onConnect(size_t index, const boost::system::error_code& ec);
+    /// @param winner index of the connected attempt, or attempts_.size() on error
+    void finish(const boost::system::error_code& ec, size_t winner);
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    std::vector<boost::asio::ip::tcp::endpoint> endpoints_;
+    std::chrono::milliseconds attemptTimeout_;
+    size_t maxConcurrent_;
+    size_t next_;
+    std::vector<std::unique_ptr<Attempt>> attempts_;
+    boost::asio::steady_timer delay_;
+    Handler handler_;
+    bool done_;
+    boost::system::error_code lastError_;
+};
+
+
+#endif
@@ -0,0 +1,125 @@
+#include "framing.h"
+
+#include <boost/asio/error.hpp>
+
+#include "common/snap_exception.hpp"
+
+using namespace std;
+
+constexpr char LineFraming::DELIMITER;
+constexpr size_t BinaryFraming::HEADER_SIZE;
+
+
+/// @return a view of n bytes at the front of buffer, wrapping frames are copied to scratch
+static boost::string_view view(const RingBuffer& buffer, size_t pos, size_t n, std::string& scratch)
+{
+    const char* data = buffer.contiguous(pos + n);
+    if (data != nullptr)
+        return boost::string_view(data + pos, n);
+    scratch.resize(n);
+    buffer.copy(pos, n, &scratch[0]);
+    return boost::string_view(scratch.data(), n);
+}
+
+
+std::unique_ptr<Framing> Framing::create(const std::string& name)
+{
+    if (name == "line")
+        return std::unique_ptr<Framing>(new LineFraming());
+    if (name == "binary")
+        return std::unique_ptr<Framing>(new BinaryFraming());
+    throw SnapException("Unknown framing: " + name);
+}
+
+
+size_t LineFraming::decode(const RingBuffer& buffer, std::string& scratch, size_t maxFrameSize, Frame& frame, boost::system::error_code& ec)
+{
+    size_t pos = buffer.find(DELIMITER, scanned_);
+    if (pos == RingBuffer::npos)
+    {
+        // the next search continues where this one stopped
+        scanned_ = buffer.size();
+        if (scanned_ > maxFrameSize)
+            ec = boost::asio::error::message_size;
+        return 0;
+    }
+    scanned_ = 0;
+    frame.type = 0;
+    frame.id = 0;
+    frame.payload = view(buffer, 0, pos, scratch);
+    return pos + 1;
+}
+
+
+void LineFraming::encodeHeader(const Frame& /*frame*/, std::string& /*out*/) const
+{
+}
+
+
+void LineFraming::encodeTrailer(const Frame& /*frame*/, std::string& out) const
+{
+    out.push_back(DELIMITER);
+}
+
+
+/// @return the big endian integer at data
+template <typename T>
+static T load(const unsigned char* data)
+{
+    T value = 0;
+    for (size_t n = 0; n < sizeof(T); ++n)
+        value = static_cast<T>((value << 8) | data[n]);
+    return value;
+}
+
+
+/// Append value in big endian byte order
+template <typename T>
+static void store(T value, std::string& out)
+{
+    for (size_t n = sizeof(T); n > 0; --n)
+        out.push_back(static_cast<char>((value >> (8 * (n - 1))) & 0xff));
+}
+
+
+size_t BinaryFraming::decode(const RingBuffer& buffer, std::string& scratch, size_t maxFrameSize, Frame& frame, boost::system::error_code& ec)
+{
+    if (buffer.size() < HEADER_SIZE)
+        return 0;
+
+    // the header is read in place, unless it wraps around the ring
+    unsigned char copy[HEADER_SIZE];
+    auto header = reinterpret_cast<const unsigned char*>(buffer.contiguous(HEADER_SIZE));
+    if (header == nullptr)
+    {
+        buffer.copy(0, HEADER_SIZE, reinterpret_cast<char*>(copy));
+        header = copy;
+    }
+
+    auto size = load<uint32_t>(header + 6);
+    if (size > maxFrameSize)
+    {
+        ec = boost::asio::error::message_size;
+        return 0;
+    }
+    if (buffer.size() < HEADER_SIZE + size)
+        return 0;
+
+    frame.type = load<uint16_t>(header);
+    frame.id = load<uint32_t>(header + 2);
+    frame.payload = view(buffer, HEADER_SIZE, size, scratch);
+    return HEADER_SIZE + size;
+}
+
+
+void BinaryFraming::encodeHeader(const Frame& frame, std::string& out) const
+{
+    store<uint16_t>(frame.type, out);
+    store<uint32_t>(frame.id, out);
+    store<uint32_t>(static_cast<uint32_t>(frame.payload.size()), out);
+}
+
+
+void BinaryFraming::encodeTrailer(const Frame& /*frame*/, std::string& /*out*/) const
+{
+}
@@ -0,0 +1,96 @@
+#ifndef __Framing_H_
+#define __Framing_H_
+#include <boost/system/error_code.hpp>
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "common/ring_buffer.hpp"
+
+/// A message as split off the byte stream
+struct Frame
+{
+    /// message type, 0 for line frames
+    uint16_t type;
+    /// correlation id, 0 for line frames
+    uint32_t id;
+    /// view into the receive buffer, only valid while the frame is dispatched
+    boost::string_view payload;
+};
+
+
+/// Splits the received byte stream into frames and encodes frames for sending
+class Framing
+{
+public:
+    virtual ~Framing() = default;
+
+    /// @return framing "line" or "binary", throws SnapException for unknown names
+    static std::unique_ptr<Framing> create(const std::string& name);
+
+    virtual const char* name() const = 0;
+
+    /// Split the next frame off the front of buffer without consuming it
+    /// @param scratch storage for frames that wrap around the end of the ring
+    /// @param ec message_size if the frame is larger than maxFrameSize
+    /// @return number of bytes to consume once the frame has been dispatched, 0 if the frame is incomplete
+    virtual size_t decode(const RingBuffer& buffer, std::string& scratch, size_t maxFrameSize, Frame& frame, boost::system::error_code& ec) = 0;
+
+    /// Append what goes before the payload of frame, so that the payload can be sent from its own buffer
+    virtual void encodeHeader(const Frame& frame, std::string& out) const = 0;
+    /// Append what goes after the payload of frame
+    virtual void encodeTrailer(const Frame& frame, std::string& out) const = 0;
+
+    /// Append the encoded frame to out
+    void encode(const Frame& frame, std::string& out) const
+    {
+        encodeHeader(frame, out);
+        out.append(frame.payload.data(), frame.payload.size());
+        encodeTrailer(frame, out);
+    }
+};
+
+
+/// Newline delimited frames, e.g. JSON-RPC for jsonrpcpp::Parser
+class LineFraming : public Framing
+{
+public:
+    LineFraming() : scanned_(0)
+    {
+    }
+
+    const char* name() const override
+    {
+        return "line";
+    }
+
+    size_t decode(const RingBuffer& buffer, std::string& scratch, size_t maxFrameSize, Frame& frame, boost::system::error_code& ec) override;
+    void encodeHeader(const Frame& frame, std::string& out) const override;
+    void encodeTrailer(const Frame& frame, std::string& out) const override;
+
+private:
+    static constexpr char DELIMITER = '\n';
+    /// position up to which the buffer has been searched for the delimiter
+    size_t scanned_;
+};
+
+
+/// Frames with a binary header: type (16 bit), id (32 bit) and payload size (32 bit), in network byte order
+/// The payload may contain any bytes, including newlines.
+class BinaryFraming : public Framing
+{
+public:
+    static constexpr size_t HEADER_SIZE = 10;
+
+    const char* name() const override
+    {
+        return "binary";
+    }
+
+    size_t decode(const RingBuffer& buffer, std::string& scratch, size_t maxFrameSize, Frame& frame, boost::system::error_code& ec) override;
+    void encodeHeader(const Frame& frame, std::string& out) const override;
+    void encodeTrailer(const Frame& frame, std::string& out) const override;
+};
+
+
+#endif
@@ -0,0 +1,83 @@
+#include "heartbeat.h"
+
+#include "common/aixlog.hpp"
+
+using namespace std;
+
+static constexpr auto LOG_TAG = "Heartbeat";
+
+
+Heartbeat::Heartbeat(const boost::asio::any_io_executor& executor, std::shared_ptr<RpcClient> rpc, std::string method, std::chrono::milliseconds interval,
+                     size_t maxMissed)
+    : rpc_(std::move(rpc)), method_(std::move(method)), interval_(interval), maxMissed_(std::max<size_t>(maxMissed, 1)), timer_(executor), missed_(0),
+      stopped_(true)
+{
+}
+
+
+void Heartbeat::start(DeadHandler onDead, AliveHandler onAlive)
+{
+    onDead_ = std::move(onDead);
+    onAlive_ = std::move(onAlive);
+    stopped_ = false;
+    auto self = shared_from_this();
+    boost::asio::post(timer_.get_executor(), [self] { self->ping(); });
+}
+
+
+void Heartbeat::stop()
+{
+    stopped_ = true;
+    timer_.cancel();
+}
+
+
+void Heartbeat::ping()
+{
+    if (stopped_)
+        return;
+    auto sent = chrono::steady_clock::now();
+    auto self = shared_from_this();
+    rpc_->call(method_, nullptr,
+               [self, sent](const boost::system::error_code& ec, const jsonrpcpp::Response& /*response*/) {
+                   if (self->stopped_)
+                       return;
+                   if (ec == boost::asio::error::timed_out)
+                   {
+                       ++self->missed_;
+                       LOG(INFO, LOG_TAG) << "Missed heartbeat " << self->missed_ << " of " << self->maxMissed_ << endl;
+                       if (self->missed_ >= self->maxMissed_)
+                       {
+                           LOG(WARNING, LOG_TAG) << "Peer is dead, no response for " << self->missed_ << " heartbeats" << endl;
+                           self->stopped_ = true;
+                           if (self->onDead_)
+                               self->onDead_();
+                           return;
+                       }
+                   }
+                   else if (ec)
+                   {
+                       // the connection is gone, that is handled by its owner
+                       self->stopped_ = true;
+                       return;
+                   }
+                   else
+                   {
+                       self->missed_ = 0;
+                       self->stats_.add(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - sent));
+                       if (self->onAlive_)
+                       {
+                           auto onAlive = std::move(self->onAlive_);
+                           self->onAlive_ = nullptr;
+                           onAlive();
+                       }
+                   }
+                   // a missed beat has used up its interval, the next ping goes out right away
+                   self->timer_.expires_at(sent + self->interval_);
+                   self->timer_.async_wait([self](const boost::system::error_code& ec) {
+                       if (!ec)
+                           self->ping();
+                   });
+               },
+               interval_);
+}
@@ -0,0 +1,57 @@
+#ifndef __Heartbeat_H_
+#define __Heartbeat_H_
+#include <boost/asio.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include "common/rtt_stats.hpp"
+#include "rpc_client.h"
+
+/// Application level ping over a JSON-RPC connection, measures the round trip and detects a dead peer
+/// A ping is a request for method, any response counts, including an error like method not found, so the
+/// server doesn't need to implement the method. A ping that isn't answered within the interval is a missed
+/// beat, after maxMissed missed beats in a row the peer is considered dead. That also catches half-open
+/// connections and servers that stopped reading, whose pings wait in the write queue.
+/// All handlers run on the executor, which must be the session's.
+class Heartbeat : public std::enable_shared_from_this<Heartbeat>
+{
+public:
+    using DeadHandler = std::function<void()>;
+    using AliveHandler = std::function<void()>;
+
+    /// c'tor
+    /// @param interval time between two pings, and the deadline of a ping
+    Heartbeat(const boost::asio::any_io_executor& executor, std::shared_ptr<RpcClient> rpc, std::string method,
+              std::chrono::milliseconds interval = std::chrono::milliseconds(5000), size_t maxMissed = 3);
+
+    /// Start pinging, the first ping is sent right away
+    /// @param onDead called once when maxMissed beats in a row have been missed, pinging stops then
+    /// @param onAlive called once with the first answered ping
+    void start(DeadHandler onDead, AliveHandler onAlive = nullptr);
+    void stop();
+
+    /// @return the round trips measured so far
+    const RttStats& stats() const
+    {
+        return stats_;
+    }
+
+private:
+    void ping();
+
+    std::shared_ptr<RpcClient> rpc_;
+    std::string method_;
+    std::chrono::milliseconds interval_;
+    size_t maxMissed_;
+    boost::asio::steady_timer timer_;
+    RttStats stats_;
+    /// missed beats in a row
+    size_t missed_;
+    bool stopped_;
+    DeadHandler onDead_;
+    AliveHandler onAlive_;
+};
+
+
+#endif
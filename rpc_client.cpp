@@ -0,0 +1,383 @@
+#include "rpc_client.h"
+
+#include <algorithm>
+
+#include "common/aixlog.hpp"
+
+using namespace std;
+
+static constexpr auto LOG_TAG = "RpcClient";
+
+/// Max number of pooled batch buffers, more are only needed while the session is congested
+static constexpr size_t MAX_BUFFERS = 8;
+
+constexpr uint16_t RpcClient::FRAME_TYPE;
+
+namespace
+{
+/// orders the deadline heap by earliest deadline first
+bool later(const pair<RpcClient::Clock::time_point, uint32_t>& lhs, const pair<RpcClient::Clock::time_point, uint32_t>& rhs)
+{
+    return lhs.first > rhs.first;
+}
+} // namespace
+
+
+RpcClient::RpcClient(std::shared_ptr<Session> session, std::chrono::milliseconds timeout, std::chrono::microseconds batchWindow, size_t batchBytes)
+    : session_(std::move(session)), timeout_(timeout), timer_(session_->get_executor()), armed_(Clock::time_point::max()), nextId_(1),
+      batchWindow_(batchWindow), batchBytes_(batchBytes), batchTimer_(session_->get_executor()), batched_(0), writer_(batch_), batchId_(0), flushScheduled_(false),
+      cancelled_(false)
+{
+}
+
+
+uint32_t RpcClient::nextId()
+{
+    // jsonrpcpp ids are ints, keep them positive and skip 0 after a wrap around
+    uint32_t id = nextId_.fetch_add(1) & 0x7fffffff;
+    if (id == 0)
+        id = nextId_.fetch_add(1) & 0x7fffffff;
+    return id;
+}
+
+
+template <typename F>
+bool RpcClient::write(uint32_t id, F fill)
+{
+    size_t mark = beginMessage(0, id);
+    try
+    {
+        fill(writer_);
+    }
+    catch (const std::exception& e)
+    {
+        // drop the partial message, the rest of the batch is intact
+        LOG(ERROR, LOG_TAG) << "Failed to serialize message: " << e.what() << endl;
+        batch_.resize(mark);
+        return false;
+    }
+    endMessage();
+    return true;
+}
+
+
+void RpcClient::call(const std::string& method, const jsonrpcpp::Parameter& params, ResponseHandler handler, std::chrono::milliseconds timeout)
+{
+    uint32_t id = nextId();
+    auto deadline = Clock::now() + ((timeout.count() > 0) ? timeout : timeout_);
+    auto self = shared_from_this();
+    boost::asio::post(session_->get_executor(), [self, id, method, params, handler = std::move(handler), deadline]() mutable {
+        self->issue(id, method, params, std::move(handler), deadline);
+    });
+}
+
+
+std::future<jsonrpcpp::Response> RpcClient::call(const std::string& method, const jsonrpcpp::Parameter& params, std::chrono::milliseconds timeout)
+{
+    auto promise = std::make_shared<std::promise<jsonrpcpp::Response>>();
+    auto future = promise->get_future();
+    call(method, params,
+         [promise](const boost::system::error_code& ec, const jsonrpcpp::Response& response) {
+             if (ec)
+                 promise->set_exception(std::make_exception_ptr(boost::system::system_error(ec)));
+             else
+                 promise->set_value(response);
+         },
+         timeout);
+    return future;
+}
+
+
+void RpcClient::notify(const std::string& method, const jsonrpcpp::Parameter& params)
+{
+    auto self = shared_from_this();
+    boost::asio::post(session_->get_executor(), [self, method, params] {
+        if (!self->cancelled_)
+            self->write(0, [&](jsonrpcpp::Writer& writer) { writer.notification(method, params); });
+    });
+}
+
+
+void RpcClient::emit(const std::string& method, ParamsWriter params)
+{
+    // the server doesn't keep up, don't add to the backlog
+    if (session_->congested())
+        return;
+    auto self = shared_from_this();
+    boost::asio::post(session_->get_executor(), [self, method, params = std::move(params)] {
+        if (self->cancelled_)
+            return;
+        self->write(0, [&](jsonrpcpp::Writer& writer) {
+            writer.notification(method).key("params");
+            params(writer);
+            writer.end_object();
+        });
+    });
+}
+
+
+void RpcClient::issue(uint32_t id, const std::string& method, const jsonrpcpp::Parameter& params, ResponseHandler handler, Clock::time_point deadline)
+{
+    if (cancelled_)
+    {
+        handler(boost::asio::error::not_connected, jsonrpcpp::Response());
+        return;
+    }
+    // the response can't arrive before the batch is flushed, so the request is registered after it has been written
+    if (!write(id, [&](jsonrpcpp::Writer& writer) { writer.request(static_cast<int>(id), method, params); }))
+    {
+        handler(boost::asio::error::invalid_argument, jsonrpcpp::Response());
+        return;
+    }
+    pending_.insert(id, Pending{std::move(handler), deadline});
+    deadlines_.emplace_back(deadline, id);
+    push_heap(deadlines_.begin(), deadlines_.end(), later);
+    arm();
+}
+
+
+size_t RpcClient::beginMessage(size_t size, uint32_t id)
+{
+    if (!batch_.empty() && (batch_.size() + size + 2 > batchBytes_))
+        flush();
+    size_t mark = batch_.size();
+    if (batch_.empty())
+    {
+        batch_.reserve(std::max(std::min(batchBytes_, 4 * size + 2), size_t(256)));
+        batch_.push_back('[');
+        batchId_ = id;
+    }
+    else
+        batch_.push_back(',');
+    return mark;
+}
+
+
+void RpcClient::endMessage()
+{
+    ++batched_;
+    if (batch_.size() + 1 >= batchBytes_)
+    {
+        flush();
+        return;
+    }
+    if (flushScheduled_)
+        return;
+
+    // A flush that is still scheduled after an early flush sends the next batch a bit early, that's fine
+    flushScheduled_ = true;
+    auto self = shared_from_this();
+    if (batchWindow_.count() == 0)
+    {
+        // runs after the handlers that are ready now, e.g. the other requests posted in this tick
+        boost::asio::post(session_->get_executor(), [self] { self->flush(); });
+        return;
+    }
+    batchTimer_.expires_after(batchWindow_);
+    batchTimer_.async_wait([self](const boost::system::error_code& ec) {
+        if (!ec)
+            self->flush();
+    });
+}
+
+
+void RpcClient::flush()
+{
+    flushScheduled_ = false;
+    if (batch_.empty())
+        return;
+    uint32_t id = 0;
+    if (batched_ == 1)
+    {
+        // a single message is sent as it is, not as a batch of one
+        batch_.erase(0, 1);
+        id = batchId_;
+    }
+    else
+        batch_.push_back(']');
+    // the batch goes out in a pooled buffer, batch_ takes over the capacity of the buffer for the next batch
+    auto buffer = spareBuffer();
+    buffer->swap(batch_);
+    session_->send(WriteQueue::Buffer(std::move(buffer)), FRAME_TYPE, id);
+    batched_ = 0;
+}
+
+
+std::shared_ptr<std::string> RpcClient::spareBuffer()
+{
+    // the session releases a buffer on the executor once it has been written or copied into its queue
+    for (const auto& buffer : buffers_)
+    {
+        if (buffer.use_count() == 1)
+        {
+            buffer->clear();
+            return buffer;
+        }
+    }
+    auto buffer = std::make_shared<std::string>();
+    if (buffers_.size() < MAX_BUFFERS)
+        buffers_.push_back(buffer);
+    return buffer;
+}
+
+
+bool RpcClient::onFrame(const Frame& frame)
+{
+    if (!jsonrpcpp::MessageScanner::scan(frame.payload, messages_))
+        return false;
+    bool handled = false;
+    {
+        jsonrpcpp::JsonArena::Scope scope(arena_);
+        for (const auto& message : messages_)
+            handled = dispatch(message) || handled;
+    }
+    // values that the handlers kept keep their blocks alive, everything else is reused for the next frame
+    arena_.reset();
+    return handled;
+}
+
+
+bool RpcClient::dispatch(const jsonrpcpp::MessageView& message)
+{
+    if (message.type == jsonrpcpp::Entity::entity_t::response)
+        return complete(message);
+    if (message.type == jsonrpcpp::Entity::entity_t::notification)
+    {
+        try
+        {
+            return methods_.notify(message);
+        }
+        catch (const std::exception& e)
+        {
+            LOG(WARNING, LOG_TAG) << "Failed to handle notification " << message.method << ": " << e.what() << endl;
+            return true;
+        }
+    }
+    if (message.type == jsonrpcpp::Entity::entity_t::request)
+    {
+        // the server waits for an answer, unknown methods are answered with method not found
+        if (!cancelled_)
+        {
+            auto response = methods_.call(message);
+            write(0, [&response](jsonrpcpp::Writer& writer) { writer.response(response); });
+        }
+        return true;
+    }
+    return false;
+}
+
+
+bool RpcClient::complete(const jsonrpcpp::MessageView& message)
+{
+    int id;
+    if (!message.id.to_int(id) || (id <= 0))
+        return false;
+    Pending pending;
+    if (!pending_.take(static_cast<uint32_t>(id), pending))
+    {
+        // answered after its deadline, or not ours, the result is never parsed
+        LOG(DEBUG, LOG_TAG) << "No pending request for response " << id << endl;
+        return true;
+    }
+    // the deadline stays in the heap until it comes up or the heap is compacted
+    if (deadlines_.size() > 2 * pending_.size() + 64)
+    {
+        deadlines_.erase(remove_if(deadlines_.begin(), deadlines_.end(),
+                                   [this](const Deadline& deadline) {
+                                       auto pending = pending_.find(deadline.second);
+                                       return (pending == nullptr) || (pending->deadline != deadline.first);
+                                   }),
+                         deadlines_.end());
+        make_heap(deadlines_.begin(), deadlines_.end(), later);
+    }
+
+    jsonrpcpp::Response response;
+    try
+    {
+        response = message.to_response();
+    }
+    catch (const std::exception& e)
+    {
+        LOG(WARNING, LOG_TAG) << "Invalid response " << id << ": " << e.what() << endl;
+        pending.handler(boost::asio::error::invalid_argument, jsonrpcpp::Response());
+        return true;
+    }
+    pending.handler({}, response);
+    return true;
+}
+
+
+void RpcClient::arm()
+{
+    // drop answered requests from the top, so the timer isn't armed for them
+    while (!deadlines_.empty())
+    {
+        auto pending = pending_.find(deadlines_.front().second);
+        if ((pending != nullptr) && (pending->deadline == deadlines_.front().first))
+            break;
+        pop_heap(deadlines_.begin(), deadlines_.end(), later);
+        deadlines_.pop_back();
+    }
+    if (deadlines_.empty())
+    {
+        if (armed_ != Clock::time_point::max())
+            timer_.cancel();
+        armed_ = Clock::time_point::max();
+        return;
+    }
+    // a timer armed for an earlier, answered request just fires early and is re-armed then
+    if (deadlines_.front().first >= armed_)
+        return;
+    armed_ = deadlines_.front().first;
+    timer_.expires_at(armed_);
+    auto self = shared_from_this();
+    timer_.async_wait([self](const boost::system::error_code& ec) {
+        if (ec)
+            return;
+        self->armed_ = Clock::time_point::max();
+        self->expire();
+    });
+}
+
+
+void RpcClient::expire()
+{
+    auto now = Clock::now();
+    while (!deadlines_.empty() && (deadlines_.front().first <= now))
+    {
+        Deadline deadline = deadlines_.front();
+        pop_heap(deadlines_.begin(), deadlines_.end(), later);
+        deadlines_.pop_back();
+        auto pending = pending_.find(deadline.second);
+        if ((pending == nullptr) || (pending->deadline != deadline.first))
+            continue;
+        Pending expired;
+        pending_.take(deadline.second, expired);
+        LOG(INFO, LOG_TAG) << "Request " << deadline.second << " timed out" << endl;
+        expired.handler(boost::asio::error::timed_out, jsonrpcpp::Response());
+    }
+    arm();
+}
+
+
+void RpcClient::cancel(const boost::system::error_code& ec)
+{
+    auto self = shared_from_this();
+    boost::asio::post(session_->get_executor(), [self, ec] {
+        if (self->cancelled_)
+            return;
+        self->cancelled_ = true;
+        self->timer_.cancel();
+        self->batchTimer_.cancel();
+        self->batch_.clear();
+        self->batched_ = 0;
+        self->armed_ = Clock::time_point::max();
+        std::vector<ResponseHandler> handlers;
+        handlers.reserve(self->pending_.size());
+        self->pending_.forEach([&handlers](uint32_t /*id*/, Pending& pending) { handlers.push_back(std::move(pending.handler)); });
+        self->pending_.clear();
+        self->deadlines_.clear();
+        for (auto& handler : handlers)
+            handler(ec, jsonrpcpp::Response());
+    });
+}
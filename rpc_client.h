@@ -0,0 +1,147 @@
+#ifndef __RpcClient_H_
+#define __RpcClient_H_
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common/id_table.hpp"
+#include "common/json_arena.hpp"
+#include "common/jsonrpc_view.hpp"
+#include "common/jsonrpc_writer.hpp"
+#include "common/jsonrpcpp.hpp"
+#include "common/method_table.hpp"
+#include "session.h"
+
+/// Asynchronous JSON-RPC client on top of a Session
+/// Requests are sent as soon as they are issued, any number of them can be in flight on the connection.
+/// Responses are matched to their requests by id, in whatever order the server sends them. Every request
+/// has a deadline, a single timer is armed for the earliest one.
+/// Outgoing messages are coalesced into JSON-RPC batches: everything issued in the same event loop tick, or
+/// within batchWindow, goes out as one write, until the batch reaches batchBytes. Messages are serialized on the
+/// executor by a jsonrpcpp::Writer straight into the batch, without building a Json DOM. Sent batches are handed to
+/// the session in pooled buffers, which are reused once they have been written.
+/// Received frames are split with the MessageScanner, only the result of a response that is waited for is parsed.
+/// Values parsed while a frame is dispatched come from the client's JsonArena, which is reset afterwards.
+/// The client runs on the session's executor, requests may be issued from any thread.
+class RpcClient : public std::enable_shared_from_this<RpcClient>
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    /// ec is timed_out if there was no response before the deadline, or the error the client was cancelled with.
+    /// Errors reported by the server are in the response's error() with ec cleared.
+    using ResponseHandler = std::function<void(const boost::system::error_code& ec, const jsonrpcpp::Response& response)>;
+    /// writes the params value of a message
+    using ParamsWriter = std::function<void(jsonrpcpp::Writer& writer)>;
+
+    /// frame type of JSON-RPC messages in binary framing, the frame id is the request id
+    static constexpr uint16_t FRAME_TYPE = 1;
+
+    /// c'tor
+    /// @param timeout default deadline of a request
+    /// @param batchWindow how long messages are collected before they are sent, 0 for the current event loop tick
+    /// @param batchBytes a batch is sent once it is this large, 0 to send every message on its own
+    explicit RpcClient(std::shared_ptr<Session> session, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000),
+                       std::chrono::microseconds batchWindow = std::chrono::microseconds::zero(), size_t batchBytes = 64 * 1024);
+
+    /// Handlers for the server's notifications and requests, register them before frames are dispatched
+    /// The handlers run on the session's executor, requests are answered with the handler's result.
+    jsonrpcpp::MethodTable& methods()
+    {
+        return methods_;
+    }
+
+    /// Send a request, handler is called once on the session's executor
+    /// @param timeout deadline of this request, 0 for the default
+    void call(const std::string& method, const jsonrpcpp::Parameter& params, ResponseHandler handler,
+              std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+    /// Send a request, the future throws boost::system::system_error if there is no response
+    /// Don't wait for the future on the session's executor, it would never be ready.
+    std::future<jsonrpcpp::Response> call(const std::string& method, const jsonrpcpp::Parameter& params,
+                                          std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+    /// Send a notification, there is no response
+    void notify(const std::string& method, const jsonrpcpp::Parameter& params);
+    /// Send a notification whose params are written by params straight into the outgoing batch
+    /// params runs on the session's executor, it must write exactly one value, e.g. an object.
+    /// These are low priority, e.g. telemetry: they are dropped while the session is congested.
+    void emit(const std::string& method, ParamsWriter params);
+
+    /// Dispatch a received frame, must be called from the session's frame handler
+    /// @return true if frame was a response, a handled notification or a request, false if it is not for the client
+    bool onFrame(const Frame& frame);
+
+    /// Complete all pending requests with ec, requests issued afterwards fail with not_connected
+    /// To be called when the session ended, may be called from any thread.
+    void cancel(const boost::system::error_code& ec = boost::asio::error::operation_aborted);
+
+private:
+    struct Pending
+    {
+        ResponseHandler handler;
+        Clock::time_point deadline;
+    };
+
+    using Deadline = std::pair<Clock::time_point, uint32_t>;
+
+    /// @return the next request id, ids are positive ints
+    uint32_t nextId();
+    /// Send and register a request, runs on the executor
+    void issue(uint32_t id, const std::string& method, const jsonrpcpp::Parameter& params, ResponseHandler handler, Clock::time_point deadline);
+    /// Add the message that fill writes with writer_ to the current batch, runs on the executor
+    /// @param id the request id, 0 for notifications
+    /// @return false if the message couldn't be serialized, it is dropped
+    template <typename F>
+    bool write(uint32_t id, F fill);
+    /// Open the next message of the batch, flushing the batch first if size wouldn't fit
+    /// @return the size of the batch before the message, to roll it back
+    size_t beginMessage(size_t size, uint32_t id);
+    /// Close the message and schedule the batch
+    void endMessage();
+    /// Send the current batch
+    void flush();
+    /// @return a buffer of the pool that the session doesn't reference anymore
+    std::shared_ptr<std::string> spareBuffer();
+    /// @return true if the response belongs to a request of the client
+    bool complete(const jsonrpcpp::MessageView& response);
+    bool dispatch(const jsonrpcpp::MessageView& message);
+    /// Arm the timer for the earliest deadline
+    void arm();
+    /// Fail all requests whose deadline has passed
+    void expire();
+
+    std::shared_ptr<Session> session_;
+    std::chrono::milliseconds timeout_;
+    boost::asio::steady_timer timer_;
+    /// the deadline the timer is armed for, max if it isn't
+    Clock::time_point armed_;
+    IdTable<Pending> pending_;
+    /// min heap of deadlines, entries of answered requests are dropped lazily
+    std::vector<Deadline> deadlines_;
+    std::atomic<uint32_t> nextId_;
+    std::chrono::microseconds batchWindow_;
+    size_t batchBytes_;
+    boost::asio::steady_timer batchTimer_;
+    /// the JSON array of the messages that are not sent yet, without the closing bracket
+    std::string batch_;
+    size_t batched_;
+    /// serializes into batch_
+    jsonrpcpp::Writer writer_;
+    /// buffers of sent batches, a buffer is reused once the session has written it
+    std::vector<std::shared_ptr<std::string>> buffers_;
+    /// request id of the first message in the batch, sent as frame id if it is the only one
+    uint32_t batchId_;
+    bool flushScheduled_;
+    bool cancelled_;
+    jsonrpcpp::MethodTable methods_;
+    /// the messages of the frame that is dispatched, kept to reuse the capacity
+    std::vector<jsonrpcpp::MessageView> messages_;
+    /// DOM of the frame that is dispatched, used if Json is built with JSONRPCPP_JSON_ARENA
+    jsonrpcpp::JsonArena arena_;
+};
+
+
+#endif
@@ -0,0 +1,249 @@
+#include "session.h"
+
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "common/aixlog.hpp"
+
+using namespace std;
+using boost::asio::ip::tcp;
+
+static constexpr auto LOG_TAG = "Session";
+
+constexpr size_t Session::READ_CHUNK;
+
+
+Session::Session(tcp::socket socket, size_t maxFrameSize)
+    : socket_(std::move(socket)), maxFrameSize_(maxFrameSize), buffer_(2 * READ_CHUNK), framing_(new LineFraming()), lowWatermark_(64 * 1024),
+      highWatermark_(1024 * 1024), writeLimit_(16 * 1024 * 1024), congested_(false), dropped_(0), closed_(false)
+{
+}
+
+
+void Session::start(FrameHandler onFrame, ErrorHandler onError)
+{
+    onFrame_ = std::move(onFrame);
+    onError_ = std::move(onError);
+    auto self = shared_from_this();
+    boost::asio::post(socket_.get_executor(), [self] { self->read(); });
+}
+
+
+void Session::setWatermarks(size_t low, size_t high, size_t limit)
+{
+    lowWatermark_ = low;
+    highWatermark_ = high;
+    writeLimit_ = limit;
+}
+
+
+void Session::setKeepAlive(std::chrono::seconds idle, std::chrono::seconds interval, int count)
+{
+    boost::system::error_code ec;
+    socket_.set_option(boost::asio::socket_base::keep_alive(idle.count() > 0), ec);
+    if (ec)
+    {
+        LOG(WARNING, LOG_TAG) << "Failed to set keepalive: " << ec.message() << endl;
+        return;
+    }
+    if (idle.count() <= 0)
+        return;
+    int fd = socket_.native_handle();
+    int idleS = static_cast<int>(idle.count());
+    int intervalS = static_cast<int>(std::max<int64_t>(interval.count(), 1));
+    count = std::max(count, 1);
+    unsigned int userTimeout = static_cast<unsigned int>(idleS + intervalS * count) * 1000u;
+    if ((setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idleS, sizeof(idleS)) != 0) ||
+        (setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intervalS, sizeof(intervalS)) != 0) ||
+        (setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) != 0) ||
+        (setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeout, sizeof(userTimeout)) != 0))
+        LOG(WARNING, LOG_TAG) << "Failed to tune keepalive: " << strerror(errno) << endl;
+}
+
+
+void Session::setCongestionHandler(CongestionHandler handler)
+{
+    onCongestion_ = std::move(handler);
+}
+
+
+void Session::send(std::string payload, uint16_t type, uint32_t id, Priority priority)
+{
+    auto self = shared_from_this();
+    boost::asio::post(socket_.get_executor(), [self, payload = std::move(payload), type, id, priority]() mutable {
+        if (!self->admit(priority))
+            return;
+        if (payload.size() <= WriteQueue::MERGE_SIZE)
+        {
+            self->queue(Frame{type, id, payload}, nullptr);
+            return;
+        }
+        // large payloads are moved into a buffer that the queue references
+        auto buffer = std::make_shared<const std::string>(std::move(payload));
+        self->queue(Frame{type, id, *buffer}, buffer);
+    });
+}
+
+
+void Session::send(WriteQueue::Buffer payload, uint16_t type, uint32_t id, Priority priority)
+{
+    auto self = shared_from_this();
+    boost::asio::post(socket_.get_executor(), [self, payload = std::move(payload), type, id, priority] {
+        if (self->admit(priority))
+            self->queue(Frame{type, id, *payload}, payload);
+    });
+}
+
+
+void Session::setFraming(std::unique_ptr<Framing> framing)
+{
+    LOG(INFO, LOG_TAG) << "Switching to " << framing->name() << " framing" << endl;
+    framing_ = std::move(framing);
+}
+
+
+void Session::close()
+{
+    auto self = shared_from_this();
+    boost::asio::post(socket_.get_executor(), [self] {
+        self->closed_ = true;
+        boost::system::error_code ignored;
+        self->socket_.close(ignored);
+    });
+}
+
+
+void Session::abort(const boost::system::error_code& ec)
+{
+    auto self = shared_from_this();
+    boost::asio::post(socket_.get_executor(), [self, ec] { self->fail(ec); });
+}
+
+
+void Session::read()
+{
+    auto regions = buffer_.prepare(READ_CHUNK);
+    std::array<boost::asio::mutable_buffer, 2> buffers{
+        {boost::asio::buffer(regions[0].first, regions[0].second), boost::asio::buffer(regions[1].first, regions[1].second)}};
+    auto self = shared_from_this();
+    socket_.async_read_some(buffers, [self](const boost::system::error_code& ec, size_t length) {
+        if (ec)
+        {
+            self->fail(ec);
+            return;
+        }
+        self->buffer_.commit(length);
+        self->dispatch();
+        if (!self->closed_)
+            self->read();
+    });
+}
+
+
+void Session::dispatch()
+{
+    while (!closed_)
+    {
+        Frame frame;
+        boost::system::error_code ec;
+        size_t length = framing_->decode(buffer_, scratch_, maxFrameSize_, frame, ec);
+        if (ec)
+        {
+            fail(ec);
+            return;
+        }
+        if (length == 0)
+            return;
+        // the handler might switch the framing, the bytes after this frame are decoded by the new one
+        onFrame_(frame);
+        buffer_.consume(length);
+    }
+}
+
+
+bool Session::admit(Priority priority)
+{
+    if (closed_)
+        return false;
+    if ((priority == Priority::Low) && congested_)
+    {
+        // the peer doesn't keep up, drop what can be dropped
+        if (dropped_++ % 1000 == 0)
+            LOG(WARNING, LOG_TAG) << "Write queue congested, dropped " << dropped_ << " low priority messages" << endl;
+        return false;
+    }
+    return true;
+}
+
+
+void Session::queue(const Frame& frame, WriteQueue::Buffer buffer)
+{
+    envelope_.clear();
+    framing_->encodeHeader(frame, envelope_);
+    writeQueue_.write(envelope_.data(), envelope_.size());
+    if (buffer)
+        writeQueue_.write(std::move(buffer));
+    else
+        writeQueue_.write(frame.payload.data(), frame.payload.size());
+    envelope_.clear();
+    framing_->encodeTrailer(frame, envelope_);
+    writeQueue_.write(envelope_.data(), envelope_.size());
+
+    if (writeQueue_.size() > writeLimit_)
+    {
+        LOG(ERROR, LOG_TAG) << "Write queue exceeds " << writeLimit_ << " bytes, the peer doesn't read" << endl;
+        fail(boost::asio::error::no_buffer_space);
+        return;
+    }
+    if (!congested_ && (writeQueue_.size() >= highWatermark_))
+    {
+        LOG(WARNING, LOG_TAG) << "Write queue congested: " << writeQueue_.size() << " bytes" << endl;
+        congested_ = true;
+        if (onCongestion_)
+            onCongestion_(true);
+    }
+    if (!writeQueue_.writing())
+        write();
+}
+
+
+void Session::write()
+{
+    auto self = shared_from_this();
+    // everything that has been queued since the last write goes out with one writev
+    boost::asio::async_write(socket_, writeQueue_.prepare(), [self](const boost::system::error_code& ec, size_t /*length*/) {
+        if (ec)
+        {
+            self->fail(ec);
+            return;
+        }
+        self->writeQueue_.consume();
+        if (self->congested_ && (self->writeQueue_.size() <= self->lowWatermark_))
+        {
+            LOG(INFO, LOG_TAG) << "Write queue drained, dropped " << self->dropped_ << " low priority messages" << endl;
+            self->congested_ = false;
+            self->dropped_ = 0;
+            if (self->onCongestion_)
+                self->onCongestion_(false);
+        }
+        if (!self->writeQueue_.empty())
+            self->write();
+    });
+}
+
+
+void Session::fail(const boost::system::error_code& ec)
+{
+    if (closed_)
+        return;
+    closed_ = true;
+    LOG(INFO, LOG_TAG) << "Session ended: " << ec.message() << endl;
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    // the queue is freed with the session, a write that is in flight may still reference it
+    if (onError_)
+        onError_(ec);
+}
@@ -0,0 +1,113 @@
+#ifndef __Session_H_
+#define __Session_H_
+#include <boost/asio.hpp>
+#include <boost/utility/string_view.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include "common/ring_buffer.hpp"
+#include "common/write_queue.hpp"
+#include "framing.h"
+
+/// Long-lived, full-duplex connection to the server
+/// The socket is read continuously into a growable ring buffer, the byte stream is split into frames in
+/// place by the current Framing and each frame is dispatched as a view into the buffer. Only frames that
+/// wrap around the end of the ring are copied, into a scratch buffer that is reused.
+/// Outgoing frames are gathered in a WriteQueue and written with writev. The queue has watermarks: above the high
+/// one the session is congested and drops low priority messages until it has drained to the low one, beyond
+/// the limit the peer is considered stalled and the session ends, so a peer that doesn't read can't make
+/// the queue grow without bound.
+/// The session starts with line framing. All handlers run on the socket's executor.
+class Session : public std::enable_shared_from_this<Session>
+{
+public:
+    /// the frame's payload is only valid during the call
+    using FrameHandler = std::function<void(const Frame& frame)>;
+    /// called once when the session ends, e.g. with eof if the server closed the connection
+    using ErrorHandler = std::function<void(const boost::system::error_code& ec)>;
+    /// called with true when the write queue reaches the high watermark, with false when it drained to the low one
+    using CongestionHandler = std::function<void(bool congested)>;
+
+    /// Low priority messages, e.g. telemetry, are dropped while the session is congested
+    enum class Priority
+    {
+        Normal,
+        Low
+    };
+
+    /// c'tor
+    /// @param maxFrameSize frames that grow beyond this size end the session with message_size
+    explicit Session(boost::asio::ip::tcp::socket socket, size_t maxFrameSize = 1024 * 1024);
+
+    void start(FrameHandler onFrame, ErrorHandler onError);
+    /// Limits of the write queue in bytes, must be set before start
+    /// @param limit the session ends with no_buffer_space if more is queued
+    void setWatermarks(size_t low, size_t high, size_t limit);
+    /// Enable TCP keepalive, so the kernel detects a dead peer even while nothing is sent
+    /// Unacknowledged data fails the connection after the same time (TCP_USER_TIMEOUT).
+    /// @param idle time without traffic before the first probe, 0 to disable keepalive
+    /// @param count unanswered probes before the connection is dropped
+    void setKeepAlive(std::chrono::seconds idle, std::chrono::seconds interval, int count);
+    /// Must be set before start
+    void setCongestionHandler(CongestionHandler handler);
+    /// @return true while the write queue is above the high watermark, may be called from any thread
+    bool congested() const
+    {
+        return congested_;
+    }
+    /// @return the executor that all handlers of the session run on
+    boost::asio::ip::tcp::socket::executor_type get_executor()
+    {
+        return socket_.get_executor();
+    }
+    /// Queue a message for sending, it is encoded by the framing that is current when it is queued
+    /// May be called from any thread, type and id are only sent by binary framing.
+    void send(std::string payload, uint16_t type = 0, uint32_t id = 0, Priority priority = Priority::Normal);
+    /// Queue a shared message for sending, large payloads are written from the buffer without copying it
+    void send(WriteQueue::Buffer payload, uint16_t type = 0, uint32_t id = 0, Priority priority = Priority::Normal);
+    /// Switch the framing, e.g. after negotiating it
+    /// Must be called on the socket's executor, from the frame handler it takes effect with the next frame.
+    void setFraming(std::unique_ptr<Framing> framing);
+    /// Close the socket, the error handler is not called
+    void close();
+    /// End the session with ec, e.g. after the peer was found dead, the error handler is called
+    void abort(const boost::system::error_code& ec);
+
+private:
+    static constexpr size_t READ_CHUNK = 4096;
+
+    void read();
+    /// Dispatch all complete frames in the buffer
+    void dispatch();
+    /// @return false if a message of priority is not queued
+    bool admit(Priority priority);
+    /// Queue the encoded frame, payload is referenced from buffer if there is one
+    void queue(const Frame& frame, WriteQueue::Buffer buffer);
+    void write();
+    void fail(const boost::system::error_code& ec);
+
+    boost::asio::ip::tcp::socket socket_;
+    size_t maxFrameSize_;
+    RingBuffer buffer_;
+    std::unique_ptr<Framing> framing_;
+    /// frames that wrap around the ring are copied here
+    std::string scratch_;
+    WriteQueue writeQueue_;
+    /// header and trailer of the frame that is queued
+    std::string envelope_;
+    size_t lowWatermark_;
+    size_t highWatermark_;
+    size_t writeLimit_;
+    std::atomic<bool> congested_;
+    /// low priority messages dropped while congested
+    size_t dropped_;
+    CongestionHandler onCongestion_;
+    FrameHandler onFrame_;
+    ErrorHandler onError_;
+    bool closed_;
+};
+
+
+#endif
@@ -6,6 +6,7 @@
 #include <boost/thread/mutex.hpp>
 #include <vector>
 #include "browse_mdns.hpp"
+#include "common/jsonrpcpp.hpp"
 #include "common/settings.hpp"
 #include "common/str_compat.hpp"
 #include "spr_client.h"
@@ -13,70 +14,343 @@ using namespace std;
 using boost::asio::ip::tcp;
 
 using namespace boost::asio;
-Client::Client() {
+
+static constexpr auto SERVICE_NAME = "hmj";
+static constexpr auto SERVICE_TYPE = "_controller._tcp.";
+
+static string mdnsHost(const mDNSResult& result)
+{
+    string host = result.ip;
+    if (result.ip_version == IPVersion::IPv6)
+        host += "%" + cpt::to_string(result.iface_idx);
+    return host;
+}
+
+/// @return the key of a controller in Client::controllers_, formatted like the address of a connected socket
+static string controllerKey(const string& host)
+{
+    boost::system::error_code ec;
+    auto address = ip::make_address(host, ec);
+    return ec ? host : address.to_string();
+}
+
+static double ms(std::chrono::microseconds us)
+{
+    return us.count() / 1000.;
+}
+
+Client::Client(boost::asio::io_context& io)
+    : io_(io), resolver_(io), reconnectTimer_(io), healthyTimer_(io), cache_(settings_.discovery.cache_file), watcherId_(0),
+      backoff_(std::chrono::milliseconds(settings_.server.reconnect_min_ms), std::chrono::milliseconds(settings_.server.reconnect_max_ms)) {
+    cache_.load();
+}
+Client::~Client()
+{
+    if (session_)
+        session_->close();
+    if (watcher_)
+        watcher_->unsubscribe(watcherId_);
 }
-Client::~Client() = default;
 
 void Client::Start()
 {
  if (settings_.server.host.empty())
     {
-        browseMdns([this](const boost::system::error_code& ec, const std::string& host, uint16_t port) {
+        watchMdns();
+        mDNSResult cached;
+        string key = mDNSCache::key(SERVICE_NAME, SERVICE_TYPE, discoveryInterface());
+        // a cached controller whose heartbeat died is revalidated by a browse instead of being tried first
+        if (cache_.get(key, cached) && !isDead(mdnsHost(cached)))
+        {
+            // Warm start: connect to the cached endpoint right away, while a browse revalidates the cache.
+            // Both run on the io_context, the fresh endpoints are tried once the cached one failed.
+            struct WarmStart
+            {
+                bool connectFailed = false;
+                bool browsed = false;
+                std::vector<mDNSResult> fresh;
+            };
+            auto warm = std::make_shared<WarmStart>();
+            string cachedHost = mdnsHost(cached);
+            auto fallback = [this, warm, cachedHost] {
+                if (!warm->connectFailed || !warm->browsed)
+                    return;
+                std::vector<mDNSResult> others;
+                for (const auto& result : warm->fresh)
+                    if (mdnsHost(result) != cachedHost)
+                        others.push_back(result);
+                if (others.empty())
+                {
+                    reconnect();
+                    return;
+                }
+                cout << "Found server " << mdnsHost(others.front()) << ":" << others.front().port << "\n";
+                connect(endpoints(others), [this](const boost::system::error_code& ec) {
+                    if (ec)
+                        reconnect();
+                });
+            };
+            browseMdns([warm, fallback](const boost::system::error_code& ec, const std::vector<mDNSResult>& results) {
+                warm->browsed = true;
+                if (!ec)
+                    warm->fresh = results;
+                fallback();
+            });
+            cout << "Trying cached server " << cachedHost << ":" << cached.port << "\n";
+            connect(endpoints({cached}), [warm, fallback](const boost::system::error_code& ec) {
+                if (!ec)
+                    return;
+                warm->connectFailed = true;
+                fallback();
+            });
+            return;
+        }
+
+        browseMdns([this](const boost::system::error_code& ec, const std::vector<mDNSResult>& results) {
             if (ec)
             {
                 cout << "Failed to browse MDNS, error: " << ec.message() << "\n";
+                reconnect();
             } else {
-                settings_.server.host = host;
-                settings_.server.port = 1000;
-                cout << "Found server " << settings_.server.host << ":" << settings_.server.port << "\n";
-                std::this_thread::sleep_for(std::chrono::seconds(2));
-                connect(host);
+                cout << "Found server " << mdnsHost(results.front()) << ":" << results.front().port << "\n";
+                connect(endpoints(results), [this](const boost::system::error_code& ec) {
+                    if (ec)
+                        reconnect();
+                });
             }
         });
     } else {
-        cout << "server.host not empty()"<<endl;
+        // configured server, host may be a name or an address
+        resolver_.async_resolve(settings_.server.host, cpt::to_string(settings_.server.port),
+                                [this](const boost::system::error_code& ec, const tcp::resolver::results_type& results) {
+                                    if (ec)
+                                    {
+                                        cout << "Failed to resolve " << settings_.server.host << ", error: " << ec.message() << "\n";
+                                        reconnect();
+                                        return;
+                                    }
+                                    std::vector<tcp::endpoint> endpoints;
+                                    for (const auto& result : results)
+                                        endpoints.push_back(result.endpoint());
+                                    connect(endpoints, [this](const boost::system::error_code& ec) {
+                                        if (ec)
+                                            reconnect();
+                                    });
+                                });
     }
 }
-void Client::connect(string host)
+std::vector<tcp::endpoint> Client::endpoints(const std::vector<mDNSResult>& results) const
 {
-    io_service iosev;
-    ip::tcp::socket socket(iosev);
-    ip::tcp::endpoint ep(ip::address_v4::from_string(host), 1000);
-    boost::system::error_code ec;
-    socket.connect(ep,ec);
-    if(ec)
+    std::vector<tcp::endpoint> endpoints;
+    for (const auto& result : results)
     {
-        std::cout << boost::system::system_error(ec).what() << std::endl;
+        boost::system::error_code ec;
+        // link local IPv6 addresses carry their interface as scope id
+        auto address = ip::make_address(mdnsHost(result), ec);
+        if (ec)
+        {
+            std::cout << "Invalid address " << mdnsHost(result) << ": " << ec.message() << std::endl;
+            continue;
+        }
+        auto port = (result.port != 0) ? result.port : static_cast<uint16_t>(settings_.server.port);
+        endpoints.emplace_back(address, port);
     }
-    char buf[100];
-    size_t len=socket.read_some(buffer(buf), ec);
-    std::cout.write(buf, len);
+    // fastest measured controllers first, then the ones never connected to in discovery order, dead ones last
+    auto rank = [this](const tcp::endpoint& endpoint) {
+        auto it = controllers_.find(endpoint.address().to_string());
+        if (it == controllers_.end())
+            return std::make_pair(1, std::chrono::microseconds(0));
+        if (it->second.dead)
+            return std::make_pair(2, std::chrono::microseconds(0));
+        if (it->second.rtt.empty())
+            return std::make_pair(1, std::chrono::microseconds(0));
+        return std::make_pair(0, it->second.rtt.avg());
+    };
+    std::stable_sort(endpoints.begin(), endpoints.end(), [&rank](const tcp::endpoint& lhs, const tcp::endpoint& rhs) { return rank(lhs) < rank(rhs); });
+    return endpoints;
+}
+void Client::connect(const std::vector<tcp::endpoint>& endpoints, const ResultHandler& handler)
+{
+    if (connector_)
+        connector_->cancel();
+    connector_ = std::make_shared<Connector>(io_, endpoints, std::chrono::milliseconds(settings_.server.connect_timeout_ms),
+                                             settings_.server.max_connect_attempts);
+    connector_->start([this, handler](const boost::system::error_code& ec, tcp::socket socket) {
+        if (ec)
+        {
+            std::cout << boost::system::system_error(ec).what() << std::endl;
+            handler(ec);
+            return;
+        }
+        // the backoff is reset once the session has proven healthy, not on connect, so that a controller
+        // which accepts and closes right away is retried with growing delays
+        boost::system::error_code remoteEc;
+        controller_ = socket.remote_endpoint(remoteEc).address().to_string();
+        controllers_[controller_].dead = false;
+        // the session keeps the connection open until the server closes it, or the heartbeat finds it dead
+        session_ = std::make_shared<Session>(std::move(socket));
+        session_->setWatermarks(settings_.server.write_low_watermark, settings_.server.write_high_watermark, settings_.server.write_limit);
+        session_->setKeepAlive(std::chrono::seconds(settings_.server.tcp_keepalive_idle_s), std::chrono::seconds(settings_.server.tcp_keepalive_interval_s),
+                               static_cast<int>(settings_.server.tcp_keepalive_count));
+        rpc_ = std::make_shared<RpcClient>(session_, std::chrono::milliseconds(settings_.server.request_timeout_ms),
+                                           std::chrono::microseconds(settings_.server.batch_window_us), settings_.server.batch_bytes);
+        session_->start([this](const Frame& frame) { onFrame(frame); },
+                        [this](const boost::system::error_code& ec) {
+                            std::cout << "Connection lost: " << ec.message() << std::endl;
+                            healthyTimer_.cancel();
+                            if (heartbeat_)
+                            {
+                                heartbeat_->stop();
+                                const auto& rtt = heartbeat_->stats();
+                                if (!rtt.empty())
+                                {
+                                    controllers_[controller_].rtt = rtt;
+                                    std::cout << "RTT to " << controller_ << " min/avg/p99/jitter: " << ms(rtt.min()) << "/" << ms(rtt.avg()) << "/"
+                                              << ms(rtt.p99()) << "/" << ms(rtt.jitter()) << " ms\n";
+                                }
+                                heartbeat_.reset();
+                            }
+                            // requests in flight won't be answered anymore
+                            rpc_->cancel(ec);
+                            rpc_.reset();
+                            session_.reset();
+                            reconnect();
+                        });
+        if (settings_.server.framing == "binary")
+            negotiateFraming();
+        startHeartbeat();
+        healthyTimer_.expires_after(std::chrono::milliseconds(settings_.server.reconnect_max_ms));
+        healthyTimer_.async_wait([this](const boost::system::error_code& ec) {
+            if (!ec)
+                backoff_.reset();
+        });
+        handler(ec);
+    });
+}
+void Client::reconnect()
+{
+    auto delay = backoff_.next();
+    cout << "Reconnecting in " << delay.count() << " ms\n";
+    reconnectTimer_.expires_after(delay);
+    reconnectTimer_.async_wait([this](const boost::system::error_code& ec) {
+        if (!ec)
+            Start();
+    });
+}
+void Client::startHeartbeat()
+{
+    if (settings_.server.heartbeat_interval_ms == 0)
+        return;
+    heartbeat_ = std::make_shared<Heartbeat>(session_->get_executor(), rpc_, settings_.server.heartbeat_method,
+                                             std::chrono::milliseconds(settings_.server.heartbeat_interval_ms), settings_.server.heartbeat_max_missed);
+    std::weak_ptr<Session> weakSession = session_;
+    string controller = controller_;
+    heartbeat_->start(
+        [this, weakSession, controller] {
+            controllers_[controller].dead = true;
+            // ends up in the session's error handler, which reconnects
+            if (auto session = weakSession.lock())
+                session->abort(boost::asio::error::timed_out);
+        },
+        [this] { backoff_.reset(); });
+}
+bool Client::isDead(const string& host) const
+{
+    auto it = controllers_.find(controllerKey(host));
+    return (it != controllers_.end()) && it->second.dead;
+}
+void Client::negotiateFraming()
+{
+    // The server answers in line framing and switches to binary framing after its response.
+    // The response handler runs from the frame handler, so the next frame is already decoded as binary.
+    std::weak_ptr<Session> weakSession = session_;
+    rpc_->call("Client.SetFraming", jsonrpcpp::Parameter("framing", "binary"),
+               [this, weakSession](const boost::system::error_code& ec, const jsonrpcpp::Response& response) {
+                   auto session = weakSession.lock();
+                   if (!session)
+                       return;
+                   // any response, even a rejection, proves that the server serves the session
+                   if (!ec)
+                       backoff_.reset();
+                   if (ec)
+                       std::cout << "Framing negotiation failed, staying with line framing: " << ec.message() << std::endl;
+                   else if (response.error())
+                       std::cout << "Binary framing rejected, staying with line framing: " << response.error().message() << std::endl;
+                   else
+                       session->setFraming(Framing::create("binary"));
+               });
+}
+void Client::onFrame(const Frame& frame)
+{
+    // responses are matched to their requests, everything else is shown
+    if (rpc_ && rpc_->onFrame(frame))
+        return;
+    std::cout.write(frame.payload.data(), frame.payload.size());
+    std::cout << std::endl;
 }
 void Client::Stop()
 {
     printf("%d: %s\n", __LINE__, __func__);
 }
 
-void Client::browseMdns(const MdnsHandler& handler)
+string Client::discoveryInterface() const
 {
-    string sn_num = "hmj";
+    if (settings_.discovery.interfaces.size() == 1)
+        return settings_.discovery.interfaces.front();
+    return "";
+}
+
+void Client::watchMdns()
+{
+    if (watcher_)
+        return;
     try
     {
-        BrowseZeroConf browser;
-        mDNSResult avahiResult;
-        if (browser.browse(string(sn_num), "_controller._tcp.","wlan0", avahiResult, 0))
-        {
-            string host = avahiResult.ip;
-            uint16_t port = avahiResult.port;
-            if (avahiResult.ip_version == IPVersion::IPv6)
-                host += "%" + cpt::to_string(avahiResult.iface_idx);
-                handler({}, host, port);
+        watcher_ = ServiceWatcher::shared(SERVICE_TYPE, discoveryInterface(), mDNSEngineFromString(settings_.discovery.engine));
+        watcherId_ = watcher_->subscribe([this](ServiceEvent event, const mDNSService& service) {
+            if (service.name != SERVICE_NAME)
                 return;
-        }
+            string key = mDNSCache::key(SERVICE_NAME, SERVICE_TYPE, discoveryInterface());
+            if (event == ServiceEvent::Removed)
+                cache_.erase(key);
+            else
+                cache_.put(key, service.result);
+            cache_.save();
+        });
+    }
+    catch (const std::exception& e)
+    {
+        cout << "Exception: " << e.what() << endl;
+    }
+}
+
+void Client::browseMdns(const MdnsHandler& handler)
+{
+    string key = mDNSCache::key(SERVICE_NAME, SERVICE_TYPE, discoveryInterface());
+    try
+    {
+        if (!browser_)
+            browser_ = BrowsemDNS::create(mDNSEngineFromString(settings_.discovery.engine));
+        // all interfaces are browsed at once, the results are ordered by rtt
+        browser_->asyncBrowseInterfaces(io_, SERVICE_NAME, SERVICE_TYPE, settings_.discovery.interfaces, 0,
+                                        [this, key, handler](const boost::system::error_code& ec, const std::vector<mDNSResult>& results) {
+                                            if (ec)
+                                            {
+                                                cache_.erase(key);
+                                                cache_.save();
+                                                handler(ec, results);
+                                                return;
+                                            }
+                                            cache_.put(key, results.front());
+                                            cache_.save();
+                                            handler({}, results);
+                                        });
     }
     catch (const std::exception& e)
     {
         cout << "Exception: " << e.what() << endl;
+        // e.g. the engine isn't compiled in, the caller retries after the backoff like after a failed browse
+        boost::asio::post(io_, [handler] { handler(boost::asio::error::operation_aborted, {}); });
     }
 
 }
@@ -85,8 +359,7 @@ int main(void)
 {
         boost::asio::io_context io_context;
 
-        auto client = std::make_shared<Client>();
+        auto client = std::make_shared<Client>(io_context);
         client->Start();
-
+        io_context.run();
 }
-
@@ -12,24 +12,76 @@
 #include <boost/asio.hpp>
 #include <memory>
 #include <algorithm>
+#include "common/backoff.hpp"
+#include "common/settings.hpp"
 #include "common/str_compat.hpp"
+#include "browseZeroConf/browse_mdns.hpp"
+#include "browseZeroConf/mdns_cache.hpp"
+#include "common/rtt_stats.hpp"
+#include "connector.h"
+#include "heartbeat.h"
+#include "rpc_client.h"
+#include "session.h"
 using namespace std;
 using namespace std::chrono_literals;
 class Client
 {
 public:
-    Client();
+    /// Discovery, connection and protocol traffic all run on io
+    explicit Client(boost::asio::io_context& io);
     ~Client();
 
     void Start();
     void Stop();
     
 private:
-    using MdnsHandler = std::function<void(const boost::system::error_code& ec, const std::string& host, uint16_t port)>;
+    using MdnsHandler = std::function<void(const boost::system::error_code& ec, const std::vector<mDNSResult>& results)>;
     using ResultHandler = std::function<void(const boost::system::error_code&)>;
     void browseMdns(const MdnsHandler& handler);
-    void connect(string host);
+    void watchMdns();
+    /// @return the interface to watch and to key the cache with, empty for all
+    string discoveryInterface() const;
+    /// @return the endpoints of results, on the discovered port or on server.port if there is none
+    /// Controllers with a measured round trip come first, fastest first, controllers found dead come last.
+    std::vector<boost::asio::ip::tcp::endpoint> endpoints(const std::vector<mDNSResult>& results) const;
+    /// Race connects to endpoints, handler is called with the result and the session starts on success
+    void connect(const std::vector<boost::asio::ip::tcp::endpoint>& endpoints, const ResultHandler& handler);
+    /// Start over after the backoff delay
+    /// The backoff is reset by the first RPC response or heartbeat of a session, or once it has lasted reconnect_max_ms.
+    void reconnect();
+    void onFrame(const Frame& frame);
+    /// Ping the server, a dead server ends the session
+    void startHeartbeat();
+    /// @return true if the controller at host was found dead by the heartbeat of its last session
+    bool isDead(const string& host) const;
+    /// Ask the server to switch to binary framing, the session stays with line framing if it refuses
+    void negotiateFraming();
+    boost::asio::io_context& io_;
+    std::shared_ptr<Session> session_;
+    std::shared_ptr<RpcClient> rpc_;
+    std::shared_ptr<Heartbeat> heartbeat_;
+    /// what the heartbeats told about a controller
+    struct ControllerStats
+    {
+        RttStats rtt;
+        bool dead = false;
+    };
+    /// keyed by the controller's address
+    std::map<string, ControllerStats> controllers_;
+    /// address of the connected controller
+    string controller_;
+    std::shared_ptr<Connector> connector_;
+    boost::asio::ip::tcp::resolver resolver_;
+    boost::asio::steady_timer reconnectTimer_;
+    /// resets the backoff once a session has lasted reconnect_max_ms, also without heartbeat and framing negotiation
+    boost::asio::steady_timer healthyTimer_;
+    std::unique_ptr<BrowsemDNS> browser_;
     Settings settings_;
+    mDNSCache cache_;
+    /// keeps the cache current while the client is running
+    std::shared_ptr<ServiceWatcher> watcher_;
+    size_t watcherId_;
+    Backoff backoff_;
     
 };
 
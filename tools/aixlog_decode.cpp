@@ -0,0 +1,81 @@
+/// Renders a binary log file written by AixLog::SinkBinary as text
+///
+/// usage: aixlog_decode [-f format] [-s severity] <file> [file...]
+///   -f  pattern like SinkFormat's, default "%Y-%m-%d %H-%M-%S.#ms [#severity] (#tag_func)"
+///   -s  skip records below severity, e.g. "notice" or "tag:debug"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "common/aixlog.hpp"
+#include "common/aixlog_binary.hpp"
+
+using namespace std;
+
+
+static void usage()
+{
+    cerr << "usage: aixlog_decode [-f format] [-s severity] <file> [file...]\n";
+}
+
+
+int main(int argc, char** argv)
+{
+    string format = "%Y-%m-%d %H-%M-%S.#ms [#severity] (#tag_func)";
+    AixLog::Filter filter;
+    int arg = 1;
+    for (; arg < argc; ++arg)
+    {
+        if ((strcmp(argv[arg], "-f") == 0) && (arg + 1 < argc))
+            format = argv[++arg];
+        else if ((strcmp(argv[arg], "-s") == 0) && (arg + 1 < argc))
+            filter.add_filter(string(argv[++arg]));
+        else if (argv[arg][0] == '-')
+        {
+            usage();
+            return 1;
+        }
+        else
+            break;
+    }
+    if (arg == argc)
+    {
+        usage();
+        return 1;
+    }
+
+    AixLog::SinkCout out(filter, format);
+    int result = 0;
+    for (; arg < argc; ++arg)
+    {
+        ifstream ifs(argv[arg], ios::binary);
+        if (!ifs)
+        {
+            cerr << "Failed to open " << argv[arg] << "\n";
+            result = 1;
+            continue;
+        }
+        stringstream data;
+        data << ifs.rdbuf();
+        try
+        {
+            AixLog::binary::Reader reader(data.str());
+            AixLog::Metadata metadata;
+            string message;
+            while (reader.next(metadata, message))
+            {
+                if (out.filter.match(metadata))
+                    out.log(metadata, message);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            cerr << argv[arg] << ": " << e.what() << "\n";
+            result = 1;
+        }
+    }
+    return result;
+}